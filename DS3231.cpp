@@ -21,8 +21,21 @@
 */
 #include "DS3231.h"
 
+// The software I2C pins, constants when the bus is fixed at compile time
+#if defined(DS3231_BUS_SOFT)
+	#define DS3231_SDA	DS3231_SDA_PIN
+	#define DS3231_SCL	DS3231_SCL_PIN
+#else
+	#define DS3231_SDA	_sda_pin
+	#define DS3231_SCL	_scl_pin
+#endif
+
 // Include hardware-specific functions for the correct MCU
-#if defined(__AVR__)
+#if defined(DS3231_HOST)
+	#include "hardware/host/HW_HOST.h"
+#elif defined(DS3231_LINUX)
+	#include "hardware/linux/HW_LINUX.h"
+#elif defined(__AVR__)
 	#include "hardware/avr/HW_AVR.h"
 #elif defined(__PIC32MX__)
   #include "hardware/pic32/HW_PIC32.h"
@@ -81,13 +94,138 @@
 #define A2F		1
 #define A1F		0
 
+#define STATUS_CONFIG	((1 << BB32KHZ) | (1 << CRATE1) | (1 << CRATE0) | (1 << EN32KHZ))
+#define STATUS_ALARMS	((1 << A2F) | (1 << A1F))	// Writing 1 keeps them
+#define STATUS_KEEP		(STATUS_CONFIG | (1 << OSF))	// Written back as read; writing 1 to OSF may set it
+
+// Register cache state bits
+#define SHADOW_ON		7
+#define SHADOW_CON		0
+#define SHADOW_STATUS	1
+
 #define SECS_DAY                (86400L)
-#define LEAPYEAR(year)          (!((year) % 4) && (((year) % 100) || !((year) % 400)))
-#define YEARSIZE(year)          (LEAPYEAR(year) ? 366L : 365L)
-static const uint8_t calender[] = { 31,28,31,30,31,30,31,31,30,31,30,31 }; // Calender Days In Month
+#define DAYS_1970_0300          (719468L)	// Days from 0000-03-01 to 1970-01-01
+#define DAYS_ERA                (146097L)	// Days in a 400 year Gregorian cycle
+
+#define SQW_DRIFT_WINDOW	64		// SQW edges per MCU drift measurement
+#define SQW_DRIFT_MAX		10000	// Larger drift readings are missed edges, in ppm
+
+#define SEQ_RETRIES			4		// Attempts of getSnapshot() to get a consistent copy
+
+// Keep the compiler from moving memory accesses across the sequence counter.
+// A single core needs no more; a backend whose writer may run on another
+// core orders the accesses in the CPU as well.
+#ifndef SEQ_ACQUIRE
+	#define SEQ_ACQUIRE()	__asm__ __volatile__ ("" ::: "memory")
+#endif
+#ifndef SEQ_RELEASE
+	#define SEQ_RELEASE()	__asm__ __volatile__ ("" ::: "memory")
+#endif
+
+// Keep the writers of the soft clock apart. tick() is the interrupt, the
+// others disable it.
+#ifndef SOFT_LOCK
+	#define SOFT_LOCK()		noInterrupts()
+	#define SOFT_UNLOCK()	interrupts()
+#endif
+#ifndef TICK_LOCK
+	#define TICK_LOCK()
+	#define TICK_UNLOCK()
+#endif
+
+#ifndef BATCH_BLOCK
+	#define BATCH_BLOCK	8			// Values per block of the batch conversions
+#endif
+
+#ifndef DS3231_PROGMEM
+	#define DS3231_PROGMEM							// Constant tables are read like RAM
+	#define DS3231_READ_BYTE(p)	(*(const uint8_t *)(p))
+	#define DS3231_TABLES_IN_RAM					// getDOWStr() and getMonthStr() can point into the tables
+#endif
+
+#ifndef DS3231_NO_FORMAT
+// "00" to "99", so a pair of digits costs one table lookup instead of a division
+static const char _digitPairs[] DS3231_PROGMEM =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Fixed width, so the tables need no pointers to the names
+static const char _dowLong[7][NAME_STR_LEN] DS3231_PROGMEM = { "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday" };
+static const char _dowShort[7][4] DS3231_PROGMEM = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+static const char _monthLong[12][NAME_STR_LEN] DS3231_PROGMEM = { "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December" };
+static const char _monthShort[12][4] DS3231_PROGMEM = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// Writes value as two digits and returns the end. The callers pass fields of
+// a Time from the caller, so a value over 99 gives its last two digits
+// instead of reading past the table.
+static inline char *_put2(char *out, uint8_t value)
+{
+	const char *p = &_digitPairs[(value % 100) * 2];
+
+	out[0] = DS3231_READ_BYTE(p);
+	out[1] = DS3231_READ_BYTE(p + 1);
+	return out + 2;
+}
+
+static inline char *_put4(char *out, uint16_t value)
+{
+	return _put2(_put2(out, (value / 100) % 100), value % 100);
+}
+
+// Copies a name from a table and returns its length
+static size_t _copyName(char *buffer, const char *name)
+{
+	size_t	n = 0;
+
+	while ((buffer[n] = DS3231_READ_BYTE(name + n)) != 0)
+		n++;
+	return n;
+}
+#endif
 
 /* Public */
 
+SeqLock::SeqLock()
+{
+	_seq = 0;
+}
+
+// The writer makes the sequence odd while it updates the data
+void SeqLock::beginWrite()
+{
+	_seq++;
+	SEQ_RELEASE();
+}
+
+void SeqLock::endWrite()
+{
+	SEQ_RELEASE();
+	_seq++;
+}
+
+uint8_t SeqLock::beginRead()
+{
+	uint8_t seq = _seq;
+
+	SEQ_ACQUIRE();
+	return seq;
+}
+
+// True if the data read since beginRead() may be torn and must be read again
+bool SeqLock::retry(uint8_t seq)
+{
+	SEQ_ACQUIRE();
+	return (seq & 1) || (seq != _seq);
+}
+
 Time::Time()
 {
 	this->year = 2014;
@@ -101,567 +239,1999 @@ Time::Time()
 
 DS3231::DS3231(uint8_t data_pin, uint8_t sclk_pin)
 {
+#if !defined(DS3231_BUS_SOFT)
 	_sda_pin = data_pin;
 	_scl_pin = sclk_pin;
+#endif
+	_shadow = 0;
+	_async = ASYNC_IDLE;
+	_timeCallback = NULL;
+	_status = BUS_OK;
+	_timeout = DS3231_BUS_TIMEOUT;
+	_softResync = 0;
+	_softDue = false;
+	_soft.sqwValid = false;
+	_soft.drift = 0;
+#ifndef DS3231_NO_TEMPERATURE
+	_temp = 0;
+	_tempValid = false;
+#endif
+#if defined(DS3231_LINUX)
+	_fd = -1;
+	pthread_mutex_init(&_softMutex, NULL);
+#endif
 }
 
 Time DS3231::getTime()
 {
 	Time t;
-	_burstRead();
-	t.sec	= _decode(_burstArray[0]);
-	t.min	= _decode(_burstArray[1]);
-	t.hour	= _decodeH(_burstArray[2]);
-	t.dow	= _burstArray[3];
-	t.date	= _decode(_burstArray[4]);
-	t.mon	= _decode(_burstArray[5]);
-	t.year	= _decodeY(_burstArray[6]) + YEAR0;
+
+	getTime(t);
 	return t;
 }
 
-void DS3231::setTime(uint8_t sec, uint8_t min, uint8_t hour)
+// Same as getTime(), but returns false and leaves t unchanged if the RTC
+// could not be read
+bool DS3231::getTime(Time &t)
 {
-	if (((hour>=0) && (hour<24)) && ((min>=0) && (min<60)) && ((sec>=0) && (sec<60)))
-	{
-		_writeRegister(REG_HOUR, _encode(hour));
-		_writeRegister(REG_MIN, _encode(min));
-		_writeRegister(REG_SEC, _encode(sec));
-	}
+	unsigned long time;
+
+	if (_softResync)
+		return _softRead(t, time);
+	_burstRead(REG_SEC, _burstArray, 7);
+	if (_status != BUS_OK)
+		return false;
+	t = _decodeTime();
+	return true;
 }
 
-void DS3231::setDate(uint8_t date, uint8_t mon, uint16_t year, uint16_t epochYear)
+// The soft clock serves getTime() and getUnixTime() from a copy of the time
+// that tick() advances on every falling edge of the 1 Hz square wave, so
+// they cost no bus traffic. The RTC is read again every resync seconds, after
+// the time has been set and on syncSoftClock(). Sets the INT/SQW pin to the
+// 1 Hz square wave; attach an interrupt that calls tick() to it.
+void DS3231::enableSoftClock(bool enable, uint16_t resync)
 {
-	YEAR0 = epochYear;
-	year -= epochYear;
-	if (((date>0) && (date<=31)) && ((mon>0) && (mon<=12)) && ((year>=0) && (year<=99)))
+	_softResync = 0;
+	if (enable && resync)
 	{
-		//year -= 2000;
-		_writeRegister(REG_YEAR, _encode(year));
-		_writeRegister(REG_MON, _encode(mon));
-		_writeRegister(REG_DATE, _encode(date));
+		setOutput(SQWAVE);
+		setSQWRate(SQWAVE_1_HZ);
+		_softInvalidate();
+		SOFT_LOCK();
+		_softLock.beginWrite();
+		_softEdge = millis();				// The first edge is due within a second
+		_softLock.endWrite();
+		SOFT_UNLOCK();
+		_softResync = resync;
+		syncSoftClock();
 	}
 }
 
-void DS3231::setDateTime(Time t, uint16_t epochYear) {
-	setTime(t.sec, t.min, t.hour);
-	setDate(t.date, t.mon, t.year, epochYear);
-	setDOW(t.dow);
-}
-
-void DS3231::setDateTime(uint8_t sec, uint8_t min, uint8_t hour, uint8_t date, uint8_t mon, uint16_t year, uint16_t epochYear = 1970) {
-	setTime(sec, min, hour);
-	setDate(date, mon, year, epochYear);
-	setDOW();
-}
-
-void DS3231::setDOW()
-{
-	int dow;
-	byte mArr[12] = {6,2,2,5,0,3,5,1,4,6,2,4};
-	Time _t = getTime();
-  
-	dow = (_t.year % 100);
-	dow = dow*1.25;
-	dow += _t.date;
-	dow += mArr[_t.mon-1];
-	if (((_t.year % 4)==0) && (_t.mon<3))
-		dow -= 1;
-	while (dow>7)
-		dow -= 7;
-	_writeRegister(REG_DOW, dow);
-}
-
-void DS3231::setDOW(uint8_t dow)
+// Reads the RTC into the soft clock. Returns false if it could not be read.
+bool DS3231::syncSoftClock()
 {
-	if ((dow>0) && (dow<8))
-		_writeRegister(REG_DOW, dow);
-}
-
-Time DS3231::makeDateTime(unsigned long time) {
-	Time t;
-	unsigned long dayclock, dayno;
-	uint16_t year = YEAR0;
-	//int yday = 0;
-
-	dayno = time / SECS_DAY;
-	dayclock = time % SECS_DAY;
-	
-	t.sec = dayclock % 60; // Seconds 0 - 59
-	t.min = (dayclock % 3600) / 60; // Minutes 0 - 59
-	t.hour = dayclock / 3600; // Hours 0 - 23
-	
-	t.dow = (dayno + 3) % 7 + 1; // Day0 was a thursday(3) | day of the week, range 1 to 7 => Start of Week Mon
+	uint8_t	seq;
+	unsigned long time;
+	Time	t;
 
-	while (dayno >= YEARSIZE(year)) {
-		dayno -= YEARSIZE(year);
-		year++;
-	}
-	
-	//t.year = year - YEAR0; // The number of years since YEAR0
-	t.year = year;
-	//yday = dayno; // day in the year, range 0 to 365
-
-	t.mon = 0; 
-	/* METHOD 1*/
-	unsigned int calDay = calender[t.mon];
-	while (dayno >= calDay) {
-		dayno -= calDay;
-		t.mon++;
-		calDay = (LEAPYEAR(year) && (t.mon == 1)) ? (calender[t.mon] + 1) : calender[t.mon];
+	// An SQW edge during the read leaves it unclear whether the time read
+	// is before or after the edge, read again in that case
+	for (uint8_t i=0; i<3; i++)
+	{
+		seq = _softLock.beginRead();
+		_burstRead(REG_SEC, _burstArray, 7);
+		if (_status != BUS_OK)
+			return false;
+		t = _decodeTime();
+		time = getUnixTime(t);
+		SOFT_LOCK();
+		if (!_softLock.retry(seq))
+		{
+			_softLock.beginWrite();
+			_soft.time = t;
+			_soft.unixTime = time;
+			_softLock.endWrite();
+			_softAge = 0;
+			_softDue = false;
+			SOFT_UNLOCK();
+			return true;
+		}
+		SOFT_UNLOCK();
 	}
-	
-	/* METHOD 2*/
-	/*while (dayno >= ((LEAPYEAR(year) && (t.mon == 1)) ? (calender[t.mon] + 1) : calender[t.mon])) {
-		dayno -= (LEAPYEAR(year) && (t.mon == 1)) ? (calender[t.mon] + 1) : calender[t.mon];
-		t.mon++;
-	}*/
-
-	t.mon += 1; // month, range 1 to 12
-	t.date = dayno + 1; // day of the month, range 1 to 31
-
-	return t;
+	return false;
 }
 
-// Set an alarm time. Sets the alarm registers only.  To cause the
-// INT pin to be asserted on alarm match, use setOutput().
-// This method can set either Alarm 1 or Alarm 2, depending on the
-// value of alarmType (use a value from the ALARM_TYPES_t enumeration).
-// When setting Alarm 2, the seconds value must be supplied but is
-// ignored, recommend using zero. (Alarm 2 has no seconds register.)
-void DS3231::setAlarm(ALARM_TYPES_t alarmType, uint8_t sec, uint8_t min, uint8_t hour, uint8_t daydate)
+// SQW hook: call it from the interrupt on the falling edge of the 1 Hz
+// square wave, which is when the DS3231 advances its seconds.
+void DS3231::tick()
 {
-	uint8_t addr;
+	unsigned long now = micros();
+	long	drift;
 
-	sec = _encode(sec); 
-	min = _encode(min);
-	hour = _encode(hour);
-	daydate = _encode(daydate);	// Date: 1-31 | Day: 1-7
-	
-	if (alarmType & 0x01) sec |= (1 << A1M1);
-	if (alarmType & 0x02) min |= (1 << A1M2);
-	if (alarmType & 0x04) hour |= (1 << A1M3);
-	if (alarmType & 0x10) daydate |= (1 << DYDT);
-	if (alarmType & 0x08) daydate |= (1 << A1M4);
+	TICK_LOCK();
+	_softLock.beginWrite();
 
-	if (!(alarmType & 0x80)) // Alarm 1
+	// Measure the MCU clock against the RTC seconds over SQW_DRIFT_WINDOW edges
+	if (_soft.sqwValid)
 	{
-		addr = ALM1_SECONDS;
-		_writeRegister(addr++, sec); 
+		if (++_sqwCount == SQW_DRIFT_WINDOW)
+		{
+			drift = (long)(now - _sqwBase - SQW_DRIFT_WINDOW * 1000000UL) / SQW_DRIFT_WINDOW;
+			if ((drift > -SQW_DRIFT_MAX) && (drift < SQW_DRIFT_MAX))
+				_soft.drift = drift;
+			_sqwBase = now;
+			_sqwCount = 0;
+		}
 	}
-	else					 // Alarm 2
+	else
 	{
-		addr = ALM2_MINUTES;
+		_sqwBase = now;
+		_sqwCount = 0;
+		_soft.sqwValid = true;
 	}
-	_writeRegister(addr++, min);
-	_writeRegister(addr++, hour);
-	_writeRegister(addr++, daydate);
-}
+	_soft.sqwMicros = now;
+	_softEdge = millis();
 
-// Returns the alarm number (if any) and resets the alarm flag bit.
-// Therefore, 0 = no alarm, 1 = Alarm 1, 2 = Alarm 2, and 3 = Both Alarms.
-uint8_t DS3231::checkAlarm(void) {
-	uint8_t _reg = _readRegister(REG_STATUS); 
-	uint8_t _creg = _readRegister(REG_CON) & _reg; 
-	
-	if (_reg & (1 << A1F))
-	{
-		_reg &= ~(1 << A1F); 
-	}
-	if (_reg & (1 << A2F))
+	if (_softResync)
 	{
-		_reg &= ~(1 << A2F);
+		_soft.unixTime++;
+		if ((_softAge < _softResync) && (++_softAge == _softResync))
+			_softDue = true;
+		if (++_soft.time.sec > 59)
+		{
+			_soft.time.sec = 0;
+			if (++_soft.time.min > 59)
+			{
+				_soft.time.min = 0;
+				if (++_soft.time.hour > 23)
+				{
+					_soft.time.hour = 0;
+					civilFromDays(daysFromCivil(_soft.time.year, _soft.time.mon, _soft.time.date) + 1, _soft.time);
+				}
+			}
+		}
 	}
-	_writeRegister(REG_STATUS, _reg); 
 
-	return _creg & 0x03;
+	_softLock.endWrite();
+	TICK_UNLOCK();
 }
 
-char *DS3231::getTimeStr(uint8_t format)
+// Copies the soft clock state without disabling interrupts, so it may also
+// be called from other interrupts. Returns false if tick() kept updating it,
+// which only happens when called from an interrupt that preempted tick().
+bool DS3231::getSnapshot(TimeSnapshot &s)
 {
-	static char output[] = "xxxxxxxx";
-	Time t;
-	t=getTime();
-	if (t.hour<10)
-		output[0]=48;
-	else
-		output[0]=char((t.hour / 10)+48);
-	output[1]=char((t.hour % 10)+48);
-	output[2]=58;
-	if (t.min<10)
-		output[3]=48;
-	else
-		output[3]=char((t.min / 10)+48);
-	output[4]=char((t.min % 10)+48);
-	output[5]=58;
-	if (format==FORMAT_SHORT)
-		output[5]=0;
-	else
+	uint8_t	seq;
+
+	for (uint8_t i=0; i<SEQ_RETRIES; i++)
 	{
-	if (t.sec<10)
-		output[6]=48;
-	else
-		output[6]=char((t.sec / 10)+48);
-	output[7]=char((t.sec % 10)+48);
-	output[8]=0;
+		seq = _softLock.beginRead();
+		s = _soft;
+		if (!_softLock.retry(seq))
+			return true;
 	}
-	return (char*)&output;
+	return false;
 }
 
-char *DS3231::getDateStr(uint8_t slformat, uint8_t eformat, char divider)
+// Reads the time into t and returns the microseconds since its second began.
+// They are interpolated with micros() from the last SQW edge and corrected
+// by the measured drift of the MCU clock, so they need the soft clock. Until
+// the first edge, and without the soft clock, they are 0.
+uint32_t DS3231::getTimeMicros(Time &t)
 {
-	static char output[] = "xxxxxxxxxx";
-	int yr, offset;
-	Time t;
-	t=getTime();
-	switch (eformat)
-	{
-		case FORMAT_LITTLEENDIAN:
-			if (t.date<10)
-				output[0]=48;
-			else
-				output[0]=char((t.date / 10)+48);
-			output[1]=char((t.date % 10)+48);
-			output[2]=divider;
-			if (t.mon<10)
-				output[3]=48;
-			else
-				output[3]=char((t.mon / 10)+48);
-			output[4]=char((t.mon % 10)+48);
-			output[5]=divider;
-			if (slformat==FORMAT_SHORT)
-			{
-				yr=t.year-YEAR0;
-				if (yr<10)
-					output[6]=48;
-				else
-					output[6]=char((yr / 10)+48);
-				output[7]=char((yr % 10)+48);
-				output[8]=0;
-			}
-			else
-			{
-				yr=t.year;
-				output[6]=char((yr / 1000)+48);
-				output[7]=char(((yr % 1000) / 100)+48);
-				output[8]=char(((yr % 100) / 10)+48);
-				output[9]=char((yr % 10)+48);
-				output[10]=0;
-			}
-			break;
-		case FORMAT_BIGENDIAN:
-			if (slformat==FORMAT_SHORT)
-				offset=0;
-			else
-				offset=2;
-			if (slformat==FORMAT_SHORT)
-			{
-				yr=t.year-YEAR0;
-				if (yr<10)
-					output[0]=48;
-				else
-					output[0]=char((yr / 10)+48);
-				output[1]=char((yr % 10)+48);
-				output[2]=divider;
-			}
-			else
-			{
-				yr=t.year;
-				output[0]=char((yr / 1000)+48);
-				output[1]=char(((yr % 1000) / 100)+48);
-				output[2]=char(((yr % 100) / 10)+48);
-				output[3]=char((yr % 10)+48);
-				output[4]=divider;
-			}
-			if (t.mon<10)
-				output[3+offset]=48;
-			else
-				output[3+offset]=char((t.mon / 10)+48);
-			output[4+offset]=char((t.mon % 10)+48);
-			output[5+offset]=divider;
-			if (t.date<10)
-				output[6+offset]=48;
-			else
-				output[6+offset]=char((t.date / 10)+48);
-			output[7+offset]=char((t.date % 10)+48);
-			output[8+offset]=0;
-			break;
-		case FORMAT_MIDDLEENDIAN:
-			if (t.mon<10)
-				output[0]=48;
-			else
-				output[0]=char((t.mon / 10)+48);
-			output[1]=char((t.mon % 10)+48);
-			output[2]=divider;
-			if (t.date<10)
-				output[3]=48;
-			else
-				output[3]=char((t.date / 10)+48);
-			output[4]=char((t.date % 10)+48);
-			output[5]=divider;
-			if (slformat==FORMAT_SHORT)
-			{
-				yr=t.year-YEAR0;
-				if (yr<10)
-					output[6]=48;
-				else
-					output[6]=char((yr / 10)+48);
-				output[7]=char((yr % 10)+48);
-				output[8]=0;
-			}
-			else
-			{
-				yr=t.year;
-				output[6]=char((yr / 1000)+48);
-				output[7]=char(((yr % 1000) / 100)+48);
-				output[8]=char(((yr % 100) / 10)+48);
-				output[9]=char((yr % 10)+48);
-				output[10]=0;
-			}
-			break;
-	}
-	return (char*)&output;
+	unsigned long time;
+	uint32_t usec;
+
+	_readMicros(t, time, usec);
+	return usec;
 }
 
-char *DS3231::getDOWStr(uint8_t format)
+// Milliseconds since the epoch year, see getTimeMicros()
+uint64_t DS3231::getUnixTimeMs()
 {
-	char *output = "xxxxxxxxxx";
-	char *daysLong[]  = {"Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday"};
-	char *daysShort[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
-	Time t;
-	t=getTime();
-	if (format == FORMAT_SHORT)
-		output = daysShort[t.dow-1];
-	else
-		output = daysLong[t.dow-1];
-	return output;
+	uint64_t ms;
+
+	getUnixTimeMs(ms);
+	return ms;
 }
 
-char *DS3231::getMonthStr(uint8_t format)
+// Same as getUnixTimeMs(), but returns false if the RTC could not be read.
+// With the soft clock that is only the case when a resync failed; ms then
+// still holds the soft clock. getBusStatus() is no help here, the soft clock
+// is read without the bus.
+bool DS3231::getUnixTimeMs(uint64_t &ms)
 {
-	char *output= "xxxxxxxxx";
-	char *monthLong[]  = {"January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December"};
-	char *monthShort[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
-	Time t;
-	t=getTime();
-	if (format == FORMAT_SHORT)
-		output = monthShort[t.mon-1];
-	else
-		output = monthLong[t.mon-1];
-	return output;
-}
+	Time	t;
+	unsigned long time;
+	uint32_t usec;
+	bool	ok = _readMicros(t, time, usec);
 
-unsigned long DS3231::getUnixTime() {
-	return getUnixTime(getTime());
+	ms = (uint64_t)time * 1000 + usec / 1000;
+	return ok;
 }
 
-unsigned long DS3231::getUnixTime(Time t)
+// Returns false if the RTC could not be read, see getUnixTimeMs(ms)
+bool DS3231::_readMicros(Time &t, unsigned long &time, uint32_t &usec)
 {
-	//unsigned long s = 0; // Seconds elapsed since epoch year midnight
-	unsigned int days = 0;
+	TimeSnapshot s;
+	unsigned long elapsed = 0;
+	uint8_t	seq;
+	bool	ok = true;
 
-	// if the current year is a leap one -> add one day (86400 sec)
-	if (!(t.year % 4) && (t.mon > 2)) 
+	if (!_softResync)
 	{
-		//s += 86400;
-		//days++;
-		days = 1;
+		ok = getTime(t);
+		time = getUnixTime(t);
+		usec = 0;
+		return ok;
 	}
-
-	// dec the current month (find how many months have passed from the current year)
-	t.mon--;
-
-	// sum the days from January to the current month of current year
-	while (t.mon)
+	if (_softStale())
+		_softInvalidate();
+	if (_softDue)
+		ok = syncSoftClock();
+
+	// micros() is taken inside the read, so that an SQW edge before it
+	// shows up as a retry
+	do
 	{
-		t.mon--; // dec the month
-		//s += calender[t.mon] * 86400;  // add the number of days from a month * 86400 sec
-		days += calender[t.mon];
-	}
+		seq = _softLock.beginRead();
+		s = _soft;
+		if (s.sqwValid)
+			elapsed = micros() - s.sqwMicros;
+	} while (_softLock.retry(seq));
+	t = s.time;
+	time = s.unixTime;
+
+	// elapsed / 16 keeps the product in 32 bits for drifts up to SQW_DRIFT_MAX
+	elapsed -= ((long)(elapsed >> 4) * s.drift) / 62500L;
+	usec = (elapsed > 999999UL) ? 999999UL : elapsed;
+	return ok;
+}
 
-	// Next, add to s variable: (the number of days from each year (even leap years)) * 86400 sec,
-	// the number of days from the current month
-	// the each hour & minute & second from the current day
-	/*s += ((((t.year - YEAR0) * 365) + ((t.year - YEAR0) / 4))*(unsigned long)86400) + (t.date - 1)*(unsigned long)86400 +
-		(t.hour*(unsigned long)3600) + (t.min*(unsigned long)60) + (unsigned long)t.sec;*/
-	days += ((t.year - YEAR0) * 365) + ((t.year - YEAR0) / 4) + (t.date - 1); // excluding today i.e. -1
+// Error of the MCU clock against the RTC in ppm, positive when micros() runs
+// fast. Measured over SQW_DRIFT_WINDOW seconds of the soft clock.
+int16_t DS3231::getMCUDrift()
+{
+	TimeSnapshot s;
 
-	//return s;
-	return ( (((days * 24L) + t.hour) * 60L + t.min) * 60L + t.sec ); // Days --> Hours --> Minutes --> Seconds
+	getSnapshot(s);
+	return s.drift;
 }
 
-void DS3231::enable32KHz(bool enable)
+// The time was written: resync on the next read, and the SQW edges restart
+// in a new phase
+void DS3231::_softInvalidate()
 {
-  uint8_t _reg = _readRegister(REG_STATUS);
-  _reg &= ~(1 << 3);
-  _reg |= (enable << 3);
-  _writeRegister(REG_STATUS, _reg);
+	SOFT_LOCK();
+	_softLock.beginWrite();
+	_soft.sqwValid = false;
+	_softLock.endWrite();
+	_softDue = true;
+	SOFT_UNLOCK();
 }
 
-void DS3231::setOutput(MODES_t mode)
+// No SQW edge for SOFTCLOCK_STALE_MS, e.g. the interrupt is not attached or
+// the pin stopped toggling. The soft clock then reads the RTC on every call
+// until the edges come back, instead of serving a frozen time.
+bool DS3231::_softStale()
 {
-  uint8_t _reg = _readRegister(REG_CON); 
-  //_reg &= ~((1 << A2IE) | (1 << A1IE)); 
-  //_reg &= ~(0x1F);
-  
-  if (mode == SQWAVE)
-  {
-	  /*_reg |= (1 << INTCN);
-	  _reg &= ~((1 << A2IE) | (1 << A1IE));*/
-
-	  //_reg = (_reg & 0xE3); // ?_reg & 11100011?
-	  //_reg &= ~(1 << INTCN);
-	  _reg &= ~((1 << INTCN) | (1 << A2IE) | (1 << A1IE));
-  }
-  else
-  {
-	  //_reg &= ~(1 << INTCN); 
-	  _reg |= _BV(INTCN);
-	  //_reg &= ~((1 << A2IE) | (1 << A1IE));
-
-	  if (mode == ALARM1)
-	  {
-		  _reg |= (1 << A1IE); 
-		  _reg &= ~(1 << A2IE);
-	  }
-	  else if (mode == ALARM2)
-	  {
-		  _reg &= ~(1 << A1IE);
-		  _reg |= (1 << A2IE); 
-	  }
-	  else
-	  {
-		  _reg |= (1 << A1IE);
-		  _reg |= (1 << A2IE); 
-	  }
+	uint8_t	seq;
+	unsigned long edge;
 
-	  //if (mode & ALARM1)
-	  //{
-		 // _reg |= (1 << A1IE); Serial.println(F("Alarm 1 Interrupt Enable"));
-		 // //_reg &= ~(1 << A2IE);
-	  //}
-	  //if (mode & ALARM2)
-	  //{
-		 // //_reg &= ~(1 << A1IE);
-		 // _reg |= (1 << A2IE); Serial.println(F("Alarm 2 Interrupt Enable"));
-	  //}
-  }
-  _writeRegister(REG_CON, _reg); 
+	do
+	{
+		seq = _softLock.beginRead();
+		edge = _softEdge;
+	} while (_softLock.retry(seq));
+	return (unsigned long)(millis() - edge) > SOFTCLOCK_STALE_MS;
 }
 
-void DS3231::setSQWRate(SQWAVE_FREQS_t rate)
+// An alarm that takes over the INT/SQW pin (INTCN set in control) stops the
+// square wave, so the soft clock is turned off and the RTC is read again
+void DS3231::_softRelease(uint8_t control)
 {
-  uint8_t _reg = _readRegister(REG_CON);
-  _reg &= ~((1 << RS2) | (1 << RS1)); 
-  
-  _reg |= (rate << 3);
-  _writeRegister(REG_CON, _reg); 
+	if (control & _BV(INTCN))
+		_softResync = 0;
 }
 
-float DS3231::getTemperature()
+// Copies the soft clock, after a resync with the RTC when one is due
+bool DS3231::_softRead(Time &t, unsigned long &time)
 {
-	uint8_t _msb = _readRegister(REG_TEMPM);
-	uint8_t _lsb = _readRegister(REG_TEMPL);
-	return (float)_msb + ((_lsb >> 6) * 0.25f);
+	uint8_t	seq;
+
+	if (_softStale())
+		_softInvalidate();
+	if (_softDue && !syncSoftClock())
+		return false;
+	do
+	{
+		seq = _softLock.beginRead();
+		t = _soft.time;
+		time = _soft.unixTime;
+	} while (_softLock.retry(seq));
+	return true;
 }
 
-/* Private */
+// Time budget of one bus transaction in microseconds, 0 waits forever. A
+// transaction that runs out of it is aborted and the bus is reset, so a
+// missing or hung RTC costs at most this long per call.
+void DS3231::setBusTimeout(unsigned long usec)
+{
+	_timeout = usec;
+}
 
-void	DS3231::_sendStart(byte addr)
+// Status of the last transaction: BUS_OK, BUS_TIMEOUT, BUS_NACK or BUS_ERROR
+uint8_t DS3231::getBusStatus()
 {
-	pinMode(_sda_pin, OUTPUT);
-	digitalWrite(_sda_pin, HIGH);
-	digitalWrite(_scl_pin, HIGH);
-	digitalWrite(_sda_pin, LOW);
-	digitalWrite(_scl_pin, LOW);
-	shiftOut(_sda_pin, _scl_pin, MSBFIRST, addr);
+	return _status;
 }
 
-void	DS3231::_sendStop()
+// Starts reading the time in the background and returns false if a transfer
+// is still in progress. When the backend has no background engine the time
+// is read right away and isReady() is already true on return.
+bool DS3231::requestTime()
 {
-	pinMode(_sda_pin, OUTPUT);
-	digitalWrite(_sda_pin, LOW);
-	digitalWrite(_scl_pin, HIGH);
-	digitalWrite(_sda_pin, HIGH);
-	pinMode(_sda_pin, INPUT);
+	return _request(REG_SEC, _burstArray, 7, true);
 }
 
-void	DS3231::_sendNack()
+// Same as requestTime() for any block of registers, e.g. both alarms or the
+// whole register file. The buffer must stay valid until isReady().
+bool DS3231::requestRegisters(uint8_t reg, uint8_t *buffer, uint8_t count)
 {
-	pinMode(_sda_pin, OUTPUT);
-	digitalWrite(_scl_pin, LOW);
-	digitalWrite(_sda_pin, HIGH);
-	digitalWrite(_scl_pin, HIGH);
-	digitalWrite(_scl_pin, LOW);
-	pinMode(_sda_pin, INPUT);
+	return _request(reg, buffer, count, false);
 }
 
-void	DS3231::_sendAck()
+// True when no background transfer is in progress. A transfer that has run
+// out of its time budget is aborted and ends in ASYNC_ERROR.
+bool DS3231::isReady()
 {
-	pinMode(_sda_pin, OUTPUT);
-	digitalWrite(_scl_pin, LOW);
-	digitalWrite(_sda_pin, LOW);
-	digitalWrite(_scl_pin, HIGH);
-	digitalWrite(_scl_pin, LOW);
-	pinMode(_sda_pin, INPUT);
+	if ((_async == ASYNC_BUSY) && _busExpired())
+		_abortRequest();
+	return _async != ASYNC_BUSY;
 }
 
-void	DS3231::_waitForAck()
+// The time read by the last completed requestTime(), no bus access
+Time DS3231::getRequestedTime()
 {
-	pinMode(_sda_pin, INPUT);
-	digitalWrite(_scl_pin, HIGH);
-	while (digitalRead(_sda_pin)==HIGH) {}
-	digitalWrite(_scl_pin, LOW);
+	return _decodeTime();
 }
 
-uint8_t DS3231::_readByte()
+// The callback runs when a requestTime() transfer completes. With a
+// background engine that is inside the interrupt, so keep it short.
+void DS3231::onTimeReady(void (*callback)(Time t))
 {
-	pinMode(_sda_pin, INPUT);
+	_timeCallback = callback;
+}
 
-	uint8_t value = 0;
-	uint8_t currentBit = 0;
+bool DS3231::_request(uint8_t reg, uint8_t *buffer, uint8_t count, bool time)
+{
+	if (_async == ASYNC_BUSY)
+		return false;
+	_async = ASYNC_BUSY;
+	_asyncTime = time;
+	_busBegin();
+	if (!_startBurstRead(reg, buffer, count))
+	{
+		_async = ASYNC_IDLE;
+		_burstRead(reg, buffer, count);
+		_burstDone(_status == BUS_OK);
+	}
+	return true;
+}
 
-	for (int i = 0; i < 8; ++i)
+void DS3231::_abortRequest()
+{
+	noInterrupts();
+	if (_async == ASYNC_BUSY)
 	{
-		digitalWrite(_scl_pin, HIGH);
-		currentBit = digitalRead(_sda_pin);
-		value |= (currentBit << 7-i);
-		delayMicroseconds(1);
-		digitalWrite(_scl_pin, LOW);
+		_busReset();
+		_burstDone(false);
 	}
-	return value;
+	interrupts();
 }
 
-void DS3231::_writeByte(uint8_t value)
+void DS3231::_burstDone(bool ok)
 {
-	pinMode(_sda_pin, OUTPUT);
-	shiftOut(_sda_pin, _scl_pin, MSBFIRST, value);
+	_async = ok ? ASYNC_DONE : ASYNC_ERROR;
+	if (ok && _asyncTime && _timeCallback)
+		_timeCallback(_decodeTime());
 }
 
-uint8_t	DS3231::_decode(uint8_t value)
+Time DS3231::_decodeTime()
 {
-	uint8_t decoded = value & 127;
-	decoded = (decoded & 15) + 10 * ((decoded & (15 << 4)) >> 4);
-	return decoded;
+	return _decodeTime(_burstArray);
 }
 
-uint8_t DS3231::_decodeH(uint8_t value)
+Time DS3231::_decodeTime(uint8_t *regs)
 {
-  if (value & 128)
-    value = (value & 15) + (12 * ((value & 32) >> 5));
-  else
-    value = (value & 15) + (10 * ((value & 48) >> 4));
-  return value;
+	Time t;
+	t.sec	= _decode(regs[0]);
+	t.min	= _decode(regs[1]);
+	t.hour	= _decodeH(regs[2]);
+	t.dow	= regs[3];
+	t.date	= _decode(regs[4]);
+	t.mon	= _decode(regs[5]);
+	t.year	= _decodeY(regs[6]) + YEAR0;
+	return t;
 }
 
-uint8_t	DS3231::_decodeY(uint8_t value)
+#ifndef DS3231_NO_TEMPERATURE
+// REG_TEMPM and REG_TEMPL in 1/4 C, the MSB is two's complement
+int16_t DS3231::_decodeTemperature(uint8_t *regs)
 {
-	uint8_t decoded = (value & 15) + 10 * ((value & (15 << 4)) >> 4);
-	return decoded;
+	return (int8_t)regs[0] * 4 + (regs[1] >> 6);
 }
 
-uint8_t DS3231::_encode(uint8_t value)
+void DS3231::_setTemperature(uint8_t *regs)
+{
+	_temp = _decodeTemperature(regs);
+	_tempTime = millis();
+	_tempValid = true;
+}
+#endif
+
+#ifndef DS3231_NO_ALARMS
+// regs starts with the seconds of Alarm 1; for Alarm 2 regs[0] is unused,
+// the inverse of _encodeAlarm()
+void DS3231::_decodeAlarm(uint8_t *regs, uint8_t alarm, DS3231Alarm &a)
+{
+	uint8_t type = (alarm == 2) ? 0x80 : 0;
+
+	if (alarm == 2)
+		a.sec = 0;
+	else
+	{
+		a.sec = _decode(regs[0]);
+		if (regs[0] & (1 << A1M1)) type |= 0x01;
+	}
+	a.min = _decode(regs[1]);
+	a.hour = _decodeH(regs[2] & 0x7F);
+	if (regs[3] & (1 << DYDT))
+		a.daydate = regs[3] & 0x0F;
+	else
+		a.daydate = _decode(regs[3] & 0x3F);
+	if (regs[1] & (1 << A1M2)) type |= 0x02;
+	if (regs[2] & (1 << A1M3)) type |= 0x04;
+	if (regs[3] & (1 << A1M4)) type |= 0x08;
+	if (regs[3] & (1 << DYDT)) type |= 0x10;
+	a.type = (ALARM_TYPES_t)type;
+}
+#endif
+
+void DS3231::setTime(uint8_t sec, uint8_t min, uint8_t hour)
+{
+	if (((hour>=0) && (hour<24)) && ((min>=0) && (min<60)) && ((sec>=0) && (sec<60)))
+	{
+		// One transaction from REG_SEC: writing the seconds first restarts the
+		// countdown chain, so minutes and hours can not roll over underneath
+		uint8_t _reg[3] = { _encode(sec), _encode(min), _encode(hour) };
+		_burstWrite(REG_SEC, _reg, 3);
+		_softInvalidate();
+	}
+}
+
+void DS3231::setDate(uint8_t date, uint8_t mon, uint16_t year, uint16_t epochYear)
+{
+	YEAR0 = epochYear;
+	year -= epochYear;
+	if (((date>0) && (date<=31)) && ((mon>0) && (mon<=12)) && ((year>=0) && (year<=99)))
+	{
+		//year -= 2000;
+		uint8_t _reg[3] = { _encode(date), _encode(mon), _encode(year) };
+		_burstWrite(REG_DATE, _reg, 3);
+		_softInvalidate();
+	}
+}
+
+void DS3231::setDateTime(Time t, uint16_t epochYear) {
+	_setDateTime(t.sec, t.min, t.hour, t.date, t.mon, t.year, t.dow, epochYear);
+}
+
+void DS3231::setDateTime(uint8_t sec, uint8_t min, uint8_t hour, uint8_t date, uint8_t mon, uint16_t year, uint16_t epochYear) {
+#ifndef DS3231_NO_DOW
+	_setDateTime(sec, min, hour, date, mon, year, _calcDOW(date, mon, year), epochYear);
+#else
+	_setDateTime(sec, min, hour, date, mon, year, 0, epochYear);	// Writes the day of the week back as it is
+#endif
+}
+
+#ifndef DS3231_NO_DOW
+void DS3231::setDOW()
+{
+	Time _t;
+	if (getTime(_t))
+		setDOW(_calcDOW(_t.date, _t.mon, _t.year));
+}
+#endif
+
+void DS3231::setDOW(uint8_t dow)
+{
+	if ((dow>0) && (dow<8))
+	{
+		_writeRegister(REG_DOW, dow);
+		_softInvalidate();
+	}
+}
+
+Time DS3231::makeDateTime(unsigned long time) {
+	return _makeDateTime(time / SECS_DAY, time % SECS_DAY);
+}
+
+Time DS3231::makeDateTime64(uint64_t time) {
+	return _makeDateTime(time / SECS_DAY, time % SECS_DAY);
+}
+
+// Days since 1970-01-01 of a Gregorian date, negative before 1970.
+// Constant time: the year is shifted to start in March, so the leap day is
+// the last day of the year and the month lengths follow (153 * m + 2) / 5.
+long DS3231::daysFromCivil(uint16_t year, uint8_t mon, uint8_t date)
+{
+	long y = (long)year - (mon <= 2);
+	long era = (y >= 0 ? y : y - 399) / 400;
+	long yoe = y - era * 400;											// Year of era [0, 399]
+	long doy = (153L * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + date - 1;	// Day of year [0, 365]
+	long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;					// Day of era [0, 146096]
+	return era * DAYS_ERA + doe - DAYS_1970_0300;
+}
+
+// Inverse of daysFromCivil(), sets year, mon, date and dow (Monday = 1)
+void DS3231::civilFromDays(long days, Time &t)
+{
+	long z = days + DAYS_1970_0300;
+	long era = (z >= 0 ? z : z - (DAYS_ERA - 1)) / DAYS_ERA;
+	long doe = z - era * DAYS_ERA;											// [0, 146096]
+	long yoe = (doe - doe / 1460 + doe / 36524 - doe / (DAYS_ERA - 1)) / 365;	// [0, 399]
+	long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);						// [0, 365]
+	long mp = (5 * doy + 2) / 153;											// March = 0
+	t.date = doy - (153 * mp + 2) / 5 + 1;
+	t.mon = mp < 10 ? mp + 3 : mp - 9;
+	t.year = yoe + era * 400 + (t.mon <= 2);
+	t.dow = ((days % 7) + 10) % 7 + 1;										// 1970-01-01 was a Thursday
+}
+
+#ifndef DS3231_NO_ALARMS
+// Set an alarm time. Sets the alarm registers only.  To cause the
+// INT pin to be asserted on alarm match, use setOutput().
+// This method can set either Alarm 1 or Alarm 2, depending on the
+// value of alarmType (use a value from the ALARM_TYPES_t enumeration).
+// When setting Alarm 2, the seconds value must be supplied but is
+// ignored, recommend using zero. (Alarm 2 has no seconds register.)
+void DS3231::setAlarm(ALARM_TYPES_t alarmType, uint8_t sec, uint8_t min, uint8_t hour, uint8_t daydate)
+{
+	uint8_t regs[4];
+
+	_encodeAlarm(alarmType, sec, min, hour, daydate, regs);
+	if (!(alarmType & 0x80)) // Alarm 1
+		_burstWrite(ALM1_SECONDS, regs, 4);
+	else					 // Alarm 2
+		_burstWrite(ALM2_MINUTES, regs + 1, 3);
+}
+
+// Sets the alarm to the epoch time given, clears its flag and lets it drive
+// the INT/SQW pin, like setOutput(ALARM1/ALARM2) but leaving the interrupt
+// enable of the other alarm as it is. The alarm registers are written in one
+// burst and REG_CON/REG_STATUS in a second one (in the same burst for Alarm
+// 2, whose registers end right before REG_CON). Alarm 2 has no seconds and
+// is rounded up to the next whole minute. Returns false on a bus error.
+bool DS3231::setAlarmAt(unsigned long time, ALARM_TYPES_t alarmType)
+{
+	uint8_t regs[9];	// ALM1_SECONDS - REG_STATUS
+	Time	t;
+
+	if ((_shadow & _BV(SHADOW_CON)) && (_shadow & _BV(SHADOW_STATUS)))
+	{
+		regs[7] = _shadowCon;
+		regs[8] = _shadowStatus;
+	}
+	else
+	{
+		_burstRead(REG_CON, regs + 7, 2);
+		if (_status != BUS_OK)
+			return false;
+	}
+	regs[7] = (regs[7] & ~(1 << CONV)) | _BV(INTCN) | ((alarmType & 0x80) ? _BV(A2IE) : _BV(A1IE));
+	_softRelease(regs[7]);
+	regs[8] = (regs[8] & STATUS_KEEP) | (STATUS_ALARMS & ~((alarmType & 0x80) ? _BV(A2F) : _BV(A1F)));
+
+	if (!(alarmType & 0x80))
+	{
+		t = makeDateTime(time);
+		_encodeAlarm(alarmType, t.sec, t.min, t.hour, (alarmType & 0x10) ? t.dow : t.date, regs);
+		_burstWrite(ALM1_SECONDS, regs, 4);
+		if (_status == BUS_OK)
+			_burstWrite(REG_CON, regs + 7, 2);
+	}
+	else
+	{
+		t = makeDateTime(time + (60 - time % 60) % 60);
+		_encodeAlarm(alarmType, t.sec, t.min, t.hour, (alarmType & 0x10) ? t.dow : t.date, regs + 3);
+		_burstWrite(ALM2_MINUTES, regs + 4, 5);
+	}
+
+	_shadowCon = regs[7];
+	_shadowStatus = regs[8] & STATUS_KEEP;
+	if (_status != BUS_OK)
+		_shadow &= ~(_BV(SHADOW_CON) | _BV(SHADOW_STATUS));
+	else if (_shadow & _BV(SHADOW_ON))
+		_shadow |= _BV(SHADOW_CON) | _BV(SHADOW_STATUS);
+	return _status == BUS_OK;
+}
+
+// The same, seconds from now
+bool DS3231::setAlarmIn(unsigned long seconds, ALARM_TYPES_t alarmType)
+{
+	Time	t;
+
+	if (!getTime(t))
+		return false;
+	return setAlarmAt(getUnixTime(t) + seconds, alarmType);
+}
+
+// Returns the alarm number (if any) and resets the alarm flag bit.
+// Therefore, 0 = no alarm, 1 = Alarm 1, 2 = Alarm 2, and 3 = Both Alarms.
+uint8_t DS3231::checkAlarm(void) {
+	return checkAlarm(3);
+}
+
+// The same for the alarms given in alarms only, the other flag is kept
+uint8_t DS3231::checkAlarm(uint8_t alarms) {
+	uint8_t _reg = _readStatus(); 
+	if (_status != BUS_OK)
+		return 0;
+	uint8_t _flags = _reg & alarms & ((1 << A2F) | (1 << A1F));
+	uint8_t _creg = _readControl() & _flags; 
+	
+	// Only clear the flags seen set, a flag raised after the read is kept
+	if (_flags)
+		_writeStatus(_reg, _flags);
+
+	return _creg & 0x03;
+}
+
+// Clears the interrupt enable and the flag of the alarms given in alarms
+// (1, 2 or 3). The alarm registers and the other alarm are kept.
+void DS3231::disableAlarm(uint8_t alarms)
+{
+	uint8_t _reg = _readControl();
+	if (_status != BUS_OK)
+		return;
+	if (_reg & alarms & ((1 << A2IE) | (1 << A1IE)))
+	{
+		_writeControl(_reg & ~(alarms & ((1 << A2IE) | (1 << A1IE))));
+		if (_status != BUS_OK)
+			return;
+	}
+	checkAlarm(alarms);
+}
+#endif
+
+#ifndef DS3231_NO_FORMAT
+char *DS3231::getTimeStr(uint8_t format)
+{
+	return getTimeStr(getTime(), format);
+}
+
+// The string is overwritten by the next call, use formatTime() where that matters
+char *DS3231::getTimeStr(Time t, uint8_t format)
+{
+	static char output[TIME_STR_LEN];
+
+	formatTime(t, output, format);
+	return output;
+}
+
+char *DS3231::getDateStr(uint8_t slformat, uint8_t eformat, char divider)
+{
+	return getDateStr(getTime(), slformat, eformat, divider);
+}
+
+// The string is overwritten by the next call, use formatDate() where that matters
+char *DS3231::getDateStr(Time t, uint8_t slformat, uint8_t eformat, char divider)
+{
+	static char output[DATE_STR_LEN];
+
+	formatDate(t, output, slformat, eformat, divider, YEAR0);
+	return output;
+}
+
+// "hh:mm:ss", or "hh:mm" with FORMAT_SHORT, into a buffer of TIME_STR_LEN
+// bytes. Returns the length of the string. Safe from interrupts.
+size_t DS3231::formatTime(Time t, char *buffer, uint8_t format)
+{
+	char	*out = buffer;
+
+	out = _put2(out, t.hour);
+	*out++ = ':';
+	out = _put2(out, t.min);
+	if (format != FORMAT_SHORT)
+	{
+		*out++ = ':';
+		out = _put2(out, t.sec);
+	}
+	*out = 0;
+	return out - buffer;
+}
+
+// The date in the order of eformat into a buffer of DATE_STR_LEN bytes. With
+// FORMAT_SHORT the year has two digits, counted from epochYear as in
+// getDateStr(). Returns the length of the string. Safe from interrupts.
+size_t DS3231::formatDate(Time t, char *buffer, uint8_t slformat, uint8_t eformat, char divider, uint16_t epochYear)
+{
+	char	*out = buffer;
+	uint8_t	year = (t.year - epochYear) % 100;
+	bool	monthFirst = (eformat == FORMAT_BIGENDIAN) || (eformat == FORMAT_MIDDLEENDIAN);
+
+	if (eformat == FORMAT_BIGENDIAN)
+	{
+		out = (slformat == FORMAT_SHORT) ? _put2(out, year) : _put4(out, t.year);
+		*out++ = divider;
+	}
+	out = _put2(out, monthFirst ? t.mon : t.date);
+	*out++ = divider;
+	out = _put2(out, monthFirst ? t.date : t.mon);
+	if (eformat != FORMAT_BIGENDIAN)
+	{
+		*out++ = divider;
+		out = (slformat == FORMAT_SHORT) ? _put2(out, year) : _put4(out, t.year);
+	}
+	*out = 0;
+	return out - buffer;
+}
+
+// ISO 8601 / RFC 3339 date and time, "yyyy-mm-ddThh:mm:ssZ", into a buffer of
+// ISO8601_STR_LEN bytes. msec from 0 to 999 adds milliseconds. The Time is
+// taken as UTC unless tzMinutes gives its offset, e.g. 60 for "+01:00".
+// Returns the length of the string. Safe from interrupts.
+size_t DS3231::formatISO8601(Time t, char *buffer, int16_t msec, int16_t tzMinutes)
+{
+	char	*out = buffer;
+
+	out = _put4(out, t.year);
+	*out++ = '-';
+	out = _put2(out, t.mon);
+	*out++ = '-';
+	out = _put2(out, t.date);
+	*out++ = 'T';
+	out = _put2(out, t.hour);
+	*out++ = ':';
+	out = _put2(out, t.min);
+	*out++ = ':';
+	out = _put2(out, t.sec);
+	if ((msec >= 0) && (msec < 1000))
+	{
+		*out++ = '.';
+		*out++ = '0' + msec / 100;
+		out = _put2(out, msec % 100);
+	}
+	if (tzMinutes == 0)
+		*out++ = 'Z';
+	else
+	{
+		*out++ = (tzMinutes < 0) ? '-' : '+';
+		if (tzMinutes < 0)
+			tzMinutes = -tzMinutes;
+		out = _put2(out, (tzMinutes / 60) % 100);
+		*out++ = ':';
+		out = _put2(out, tzMinutes % 60);
+	}
+	*out = 0;
+	return out - buffer;
+}
+
+// The current time of the RTC, with milliseconds if asked. These come from
+// getUnixTimeMs(), so they need the soft clock.
+size_t DS3231::formatISO8601(char *buffer, bool msec, int16_t tzMinutes)
+{
+	uint64_t ms;
+
+	if (!msec)
+		return formatISO8601(getTime(), buffer, -1, tzMinutes);
+	ms = getUnixTimeMs();
+	return formatISO8601(makeDateTime64(ms / 1000), buffer, ms % 1000, tzMinutes);
+}
+
+char *DS3231::getDOWStr(uint8_t format)
+{
+	return getDOWStr(getTime(), format);
+}
+
+// Where the names are kept in flash, they are copied into a buffer that the
+// next call overwrites, use formatDOW() where that matters
+char *DS3231::getDOWStr(Time t, uint8_t format)
+{
+	static char output[NAME_STR_LEN];
+
+#ifdef DS3231_TABLES_IN_RAM
+	if ((t.dow >= 1) && (t.dow <= 7))
+		return (char *)((format == FORMAT_SHORT) ? _dowShort[t.dow-1] : _dowLong[t.dow-1]);
+#endif
+	formatDOW(t.dow, output, format);
+	return output;
+}
+
+char *DS3231::getMonthStr(uint8_t format)
+{
+	return getMonthStr(getTime(), format);
+}
+
+// The same as getDOWStr(), use formatMonth() where that matters
+char *DS3231::getMonthStr(Time t, uint8_t format)
+{
+	static char output[NAME_STR_LEN];
+
+#ifdef DS3231_TABLES_IN_RAM
+	if ((t.mon >= 1) && (t.mon <= 12))
+		return (char *)((format == FORMAT_SHORT) ? _monthShort[t.mon-1] : _monthLong[t.mon-1]);
+#endif
+	formatMonth(t.mon, output, format);
+	return output;
+}
+
+// The English name of the day of the week (1 = Monday) into a buffer of
+// NAME_STR_LEN bytes, abbreviated to three letters with FORMAT_SHORT. The
+// names are read from flash on AVR. Returns the length, 0 for an invalid day.
+size_t DS3231::formatDOW(uint8_t dow, char *buffer, uint8_t format)
+{
+	buffer[0] = 0;
+	if ((dow < 1) || (dow > 7))
+		return 0;
+	return _copyName(buffer, (format == FORMAT_SHORT) ? _dowShort[dow-1] : _dowLong[dow-1]);
+}
+
+// The same for the month (1 = January)
+size_t DS3231::formatMonth(uint8_t mon, char *buffer, uint8_t format)
+{
+	buffer[0] = 0;
+	if ((mon < 1) || (mon > 12))
+		return 0;
+	return _copyName(buffer, (format == FORMAT_SHORT) ? _monthShort[mon-1] : _monthLong[mon-1]);
+}
+#endif
+
+unsigned long DS3231::getUnixTime() {
+	Time t;
+	unsigned long time;
+
+	if (_softResync)
+		return _softRead(t, time) ? time : 0;
+	return getUnixTime(getTime());
+}
+
+// Seconds since 00:00:00 on January 1st of the epoch year
+unsigned long DS3231::getUnixTime(Time t)
+{
+	unsigned long days = daysFromCivil(t.year, t.mon, t.date) - daysFromCivil(YEAR0, 1, 1);
+	return ( (((days * 24L) + t.hour) * 60L + t.min) * 60L + t.sec ); // Days --> Hours --> Minutes --> Seconds
+}
+
+uint64_t DS3231::getUnixTime64(Time t)
+{
+	uint64_t days = daysFromCivil(t.year, t.mon, t.date) - daysFromCivil(YEAR0, 1, 1);
+	return ( (((days * 24) + t.hour) * 60 + t.min) * 60 + t.sec );
+}
+
+// Batch conversions. They work on blocks of BATCH_BLOCK values with plain
+// unsigned 32-bit arithmetic and no branches or table lookups in the inner
+// loops, so that the compiler can vectorize them on the host. The constants
+// are kept 32-bit as well, a long operand would widen the whole loop.
+#define SECS_DAY32	((uint32_t)SECS_DAY)
+#define DAYS_ERA32	((uint32_t)DAYS_ERA)
+
+// Converts count Unix times (seconds since the epoch year) to Time structures
+void DS3231::makeDateTime(const unsigned long *time, Time *t, size_t count)
+{
+	uint32_t base = daysFromCivil(YEAR0, 1, 1) + DAYS_1970_0300;	// Epoch in days since 0000-03-01
+	uint32_t clk[BATCH_BLOCK], year[BATCH_BLOCK], mon[BATCH_BLOCK], date[BATCH_BLOCK], dow[BATCH_BLOCK];
+
+	for (size_t i = 0; i < count; i += BATCH_BLOCK)
+	{
+		size_t n = (count - i < BATCH_BLOCK) ? count - i : BATCH_BLOCK;
+
+		for (size_t j = 0; j < n; j++)
+		{
+			uint32_t s = time[i + j];
+			uint32_t z = s / SECS_DAY32 + base;
+			uint32_t era = z / DAYS_ERA32;
+			uint32_t doe = z - era * DAYS_ERA32;
+			uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / (DAYS_ERA32 - 1)) / 365;
+			uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+			uint32_t mp = (5 * doy + 2) / 153;
+			uint32_t m = mp + ((mp < 10) ? 3 : -9);
+
+			clk[j] = s % SECS_DAY32;
+			date[j] = doy - (153 * mp + 2) / 5 + 1;
+			mon[j] = m;
+			year[j] = yoe + era * 400 + (m <= 2);
+			dow[j] = (z + 2) % 7 + 1;						// 0000-03-01 was a Wednesday
+		}
+		for (size_t j = 0; j < n; j++)
+		{
+			Time &r = t[i + j];
+			r.hour = clk[j] / 3600;
+			r.min = (clk[j] / 60) % 60;
+			r.sec = clk[j] % 60;
+			r.date = date[j];
+			r.mon = mon[j];
+			r.year = year[j];
+			r.dow = dow[j];
+		}
+	}
+}
+
+// Converts count Time structures to Unix times (seconds since the epoch year)
+void DS3231::getUnixTime(const Time *t, unsigned long *time, size_t count)
+{
+	uint32_t base = daysFromCivil(YEAR0, 1, 1) + DAYS_1970_0300;
+	uint32_t year[BATCH_BLOCK], mon[BATCH_BLOCK], date[BATCH_BLOCK], clk[BATCH_BLOCK];
+
+	for (size_t i = 0; i < count; i += BATCH_BLOCK)
+	{
+		size_t n = (count - i < BATCH_BLOCK) ? count - i : BATCH_BLOCK;
+
+		for (size_t j = 0; j < n; j++)
+		{
+			const Time &r = t[i + j];
+			year[j] = r.year;
+			mon[j] = r.mon;
+			date[j] = r.date;
+			clk[j] = (r.hour * 60 + r.min) * 60 + r.sec;
+		}
+		for (size_t j = 0; j < n; j++)
+		{
+			uint32_t m = mon[j];
+			uint32_t y = year[j] - (m <= 2);
+			uint32_t era = y / 400;
+			uint32_t yoe = y - era * 400;
+			uint32_t doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + date[j] - 1;
+			uint32_t days = era * DAYS_ERA32 + yoe * 365 + yoe / 4 - yoe / 100 + doy - base;
+
+			time[i + j] = days * SECS_DAY32 + clk[j];
+		}
+	}
+}
+
+#ifndef DS3231_NO_FORMAT
+// Formats count Unix times as DATETIME_STR_LEN byte records "dd.mm.yyyy hh:mm:ss"
+// in the order given by eformat (see getDateStr()), each terminated by a zero.
+void DS3231::formatDateTime(const unsigned long *time, char *buffer, size_t count, uint8_t eformat, char divider)
+{
+	Time t[BATCH_BLOCK];
+	uint8_t pd, pm, py;
+
+	switch (eformat)
+	{
+		case FORMAT_BIGENDIAN:		py = 0; pm = 5; pd = 8; break;
+		case FORMAT_MIDDLEENDIAN:	pm = 0; pd = 3; py = 6; break;
+		default:					pd = 0; pm = 3; py = 6; break;
+	}
+
+	for (size_t i = 0; i < count; i += BATCH_BLOCK)
+	{
+		size_t n = (count - i < BATCH_BLOCK) ? count - i : BATCH_BLOCK;
+
+		makeDateTime(time + i, t, n);
+		for (size_t j = 0; j < n; j++)
+		{
+			char *out = buffer + (i + j) * DATETIME_STR_LEN;
+
+			_put2(out + pd, t[j].date);
+			_put2(out + pm, t[j].mon);
+			_put4(out + py, t[j].year);
+			out[(eformat == FORMAT_BIGENDIAN) ? 4 : 2] = divider;
+			out[(eformat == FORMAT_BIGENDIAN) ? 7 : 5] = divider;
+			out[10]		= ' ';
+			formatTime(t[j], out + 11);
+		}
+	}
+}
+#endif
+
+void DS3231::enable32KHz(bool enable)
+{
+  uint8_t _reg = (_shadow & _BV(SHADOW_STATUS)) ? _shadowStatus : _readStatus();
+  _reg &= ~(1 << EN32KHZ);
+  _reg |= (enable << EN32KHZ);
+  _writeStatus(_reg, 0);
+}
+
+void DS3231::setOutput(MODES_t mode)
+{
+  uint8_t _reg = _readControl(); 
+  //_reg &= ~((1 << A2IE) | (1 << A1IE)); 
+  //_reg &= ~(0x1F);
+  
+  if (mode == SQWAVE)
+  {
+	  /*_reg |= (1 << INTCN);
+	  _reg &= ~((1 << A2IE) | (1 << A1IE));*/
+
+	  //_reg = (_reg & 0xE3); // ?_reg & 11100011?
+	  //_reg &= ~(1 << INTCN);
+	  _reg &= ~((1 << INTCN) | (1 << A2IE) | (1 << A1IE));
+  }
+  else
+  {
+	  //_reg &= ~(1 << INTCN); 
+	  _reg |= _BV(INTCN);
+	  //_reg &= ~((1 << A2IE) | (1 << A1IE));
+
+	  if (mode == ALARM1)
+	  {
+		  _reg |= (1 << A1IE); 
+		  _reg &= ~(1 << A2IE);
+	  }
+	  else if (mode == ALARM2)
+	  {
+		  _reg &= ~(1 << A1IE);
+		  _reg |= (1 << A2IE); 
+	  }
+	  else
+	  {
+		  _reg |= (1 << A1IE);
+		  _reg |= (1 << A2IE); 
+	  }
+
+	  //if (mode & ALARM1)
+	  //{
+		 // _reg |= (1 << A1IE); Serial.println(F("Alarm 1 Interrupt Enable"));
+		 // //_reg &= ~(1 << A2IE);
+	  //}
+	  //if (mode & ALARM2)
+	  //{
+		 // //_reg &= ~(1 << A1IE);
+		 // _reg |= (1 << A2IE); Serial.println(F("Alarm 2 Interrupt Enable"));
+	  //}
+  }
+  _writeControl(_reg); 
+}
+
+void DS3231::setSQWRate(SQWAVE_FREQS_t rate)
+{
+  uint8_t _reg = _readControl();
+  _reg &= ~((1 << RS2) | (1 << RS1)); 
+  
+  _reg |= (rate << 3);
+  _writeControl(_reg); 
+}
+
+#ifndef DS3231_NO_TEMPERATURE
+// The temperature registers only change with a conversion, every 64
+// seconds, so the value is cached for TEMP_CACHE_MS. The lifetime starts when
+// the value is read, not at a conversion, whose phase the bus does not show:
+// a value read just before a conversion is served until almost the end of
+// the next period, up to TEMP_CACHE_MS + 64 s after it was measured.
+float DS3231::getTemperature()
+{
+	return getTemperatureQuarters() * 0.25f;
+}
+
+// The same in 1/4 C, without any floating point math. On a bus error the
+// last value read is returned, see getBusStatus().
+int16_t DS3231::getTemperatureQuarters()
+{
+	uint8_t _reg[2];
+
+	if ((!_tempValid) || ((unsigned long)(millis() - _tempTime) >= TEMP_CACHE_MS))
+	{
+		_burstRead(REG_TEMPM, _reg, 2);
+		if (_status == BUS_OK)
+			_setTemperature(_reg);
+	}
+	return _temp;
+}
+#endif
+
+// The aging offset trims the oscillator by about 0.1 ppm per step, positive
+// values slow it down. It takes effect with the next temperature conversion.
+int8_t DS3231::getAgingOffset()
+{
+	return (int8_t)_readRegister(REG_AGING);
+}
+
+void DS3231::setAgingOffset(int8_t offset)
+{
+	_writeRegister(REG_AGING, (uint8_t)offset);
+}
+
+#ifndef DS3231_NO_TEMPERATURE
+// Forces a temperature conversion without waiting for it. Returns false if
+// a conversion is already running (BSY or CONV set) or on a bus error; try
+// again later then. The conversion takes about 125 - 200 ms.
+bool DS3231::startTemperatureConversion()
+{
+	uint8_t _reg[2];	// REG_CON, REG_STATUS
+
+	_burstRead(REG_CON, _reg, 2);
+	if ((_status != BUS_OK) || (_reg[0] & (1 << CONV)) || (_reg[1] & (1 << BSY)))
+		return false;
+	_reg[0] |= (1 << CONV);
+	_writeRegister(REG_CON, _reg[0]);
+	return _status == BUS_OK;
+}
+
+// True when the forced conversion is done, the chip then clears CONV. One
+// register read, so it can be polled from the main loop.
+bool DS3231::temperatureReady()
+{
+	uint8_t _reg = _readRegister(REG_CON);
+
+	return (_status == BUS_OK) && !(_reg & (1 << CONV));
+}
+
+// Reads the temperature right away, bypassing and refreshing the cache
+float DS3231::readTemperature()
+{
+	_tempValid = false;
+	return getTemperature();
+}
+#endif
+
+// Reads all registers, 0x00 - 0x12, in a single burst. Returns false on a
+// bus error, s is then unchanged.
+bool DS3231::readAll(DS3231State &s)
+{
+	uint8_t regs[DS3231_REGS];
+
+	_burstRead(REG_SEC, regs, DS3231_REGS);
+	if (_status != BUS_OK)
+		return false;
+	decodeState(regs, s);
+#ifndef DS3231_NO_TEMPERATURE
+	_setTemperature(regs + REG_TEMPM);
+#endif
+
+	// The cached registers come for free
+	_shadowCon = regs[REG_CON] & ~(1 << CONV);
+	_shadowStatus = regs[REG_STATUS] & STATUS_KEEP;
+	if (_shadow & _BV(SHADOW_ON))
+		_shadow |= _BV(SHADOW_CON) | _BV(SHADOW_STATUS);
+	return true;
+}
+
+// Decodes a copy of the register file, e.g. one read in the background with
+// requestRegisters(0x00, regs, DS3231_REGS)
+void DS3231::decodeState(uint8_t *regs, DS3231State &s)
+{
+	s.time = _decodeTime(regs);
+#ifndef DS3231_NO_ALARMS
+	_decodeAlarm(regs + ALM1_SECONDS, 1, s.alarm1);
+	_decodeAlarm(regs + ALM2_MINUTES - 1, 2, s.alarm2);
+#endif
+	s.control = regs[REG_CON];
+	s.status = regs[REG_STATUS];
+	s.aging = (int8_t)regs[REG_AGING];
+#ifndef DS3231_NO_TEMPERATURE
+	s.temperature = _decodeTemperature(regs + REG_TEMPM) * 0.25f;
+#endif
+}
+
+// The register cache keeps a write-through copy of the control register and
+// the configuration bits of the status register, so that output, square-wave
+// and 32kHz changes cost a single register write. The alarm, OSF and BSY flags
+// are changed by the chip itself and are always read from the chip. OSF is
+// also kept as last read, to write it back unchanged.
+void DS3231::enableRegisterCache(bool enable)
+{
+	_shadow = enable ? _BV(SHADOW_ON) : 0;
+}
+
+// Forget the cached registers, e.g. after the RTC has lost power or another
+// bus master has written them. The next access reads them from the chip.
+void DS3231::invalidateRegisterCache()
+{
+	_shadow &= _BV(SHADOW_ON);
+}
+
+void DS3231::refreshRegisterCache()
+{
+	invalidateRegisterCache();
+	_readControl();
+	_readStatus();
+}
+
+/* Private */
+
+// Writes REG_SEC to REG_YEAR in a single transaction, dow 0 writes back the
+// day of the week the chip has. Falls back to the individual setters if some
+// of the fields are out of range.
+void DS3231::_setDateTime(uint8_t sec, uint8_t min, uint8_t hour, uint8_t date, uint8_t mon, uint16_t year, uint8_t dow, uint16_t epochYear)
+{
+	if ((hour<24) && (min<60) && (sec<60) && (date>0) && (date<=31) && (mon>0) && (mon<=12) &&
+		(year>=epochYear) && (year-epochYear<=99) && (dow<8))
+	{
+		if (dow==0)
+		{
+			dow = _readRegister(REG_DOW) & 0x07;
+			if (_status != BUS_OK)
+				return;
+		}
+		uint8_t _reg[7] = { _encode(sec), _encode(min), _encode(hour), dow, _encode(date), _encode(mon), _encode(year-epochYear) };
+		YEAR0 = epochYear;
+		_burstWrite(REG_SEC, _reg, 7);
+		_softInvalidate();
+	}
+	else
+	{
+		setTime(sec, min, hour);
+		setDate(date, mon, year, epochYear);
+		setDOW(dow);
+	}
+}
+
+#ifndef DS3231_NO_DOW
+// Day of the week, Monday = 1
+uint8_t DS3231::_calcDOW(uint8_t date, uint8_t mon, uint16_t year)
+{
+	return ((daysFromCivil(year, mon, date) % 7) + 10) % 7 + 1;
+}
+#endif
+
+#ifndef DS3231_NO_ALARMS
+// Alarm registers in chip format, from the seconds of Alarm 1 on. For
+// Alarm 2, whose registers start with the minutes, regs[0] is unused.
+void DS3231::_encodeAlarm(ALARM_TYPES_t alarmType, uint8_t sec, uint8_t min, uint8_t hour, uint8_t daydate, uint8_t *regs)
+{
+	regs[0] = _encode(sec); 
+	regs[1] = _encode(min);
+	regs[2] = _encode(hour);
+	regs[3] = _encode(daydate);	// Date: 1-31 | Day: 1-7
+	
+	if (alarmType & 0x01) regs[0] |= (1 << A1M1);
+	if (alarmType & 0x02) regs[1] |= (1 << A1M2);
+	if (alarmType & 0x04) regs[2] |= (1 << A1M3);
+	if (alarmType & 0x10) regs[3] |= (1 << DYDT);
+	if (alarmType & 0x08) regs[3] |= (1 << A1M4);
+}
+#endif
+
+Time DS3231::_makeDateTime(long days, unsigned long dayclock)
+{
+	Time t;
+
+	t.sec = dayclock % 60; // Seconds 0 - 59
+	t.min = (dayclock % 3600) / 60; // Minutes 0 - 59
+	t.hour = dayclock / 3600; // Hours 0 - 23
+	civilFromDays(days + daysFromCivil(YEAR0, 1, 1), t);
+	return t;
+}
+
+uint8_t DS3231::_readControl()
+{
+	if (!(_shadow & _BV(SHADOW_CON)))
+	{
+		_shadowCon = _readRegister(REG_CON) & ~(1 << CONV);
+		if ((_shadow & _BV(SHADOW_ON)) && (_status == BUS_OK))
+			_shadow |= _BV(SHADOW_CON);
+	}
+	return _shadowCon;
+}
+
+// CONV is never written back, the chip clears it when a conversion is done
+void DS3231::_writeControl(uint8_t value)
+{
+	_softRelease(value);
+	_shadowCon = value & ~(1 << CONV);
+	_writeRegister(REG_CON, _shadowCon);
+	if (_status != BUS_OK)
+		_shadow &= ~_BV(SHADOW_CON);		// The chip may still hold the old value
+	else if (_shadow & _BV(SHADOW_ON))
+		_shadow |= _BV(SHADOW_CON);
+}
+
+// Always reads the chip; only the configuration bits and OSF are cached
+uint8_t DS3231::_readStatus()
+{
+	uint8_t _reg = _readRegister(REG_STATUS);
+	_shadowStatus = _reg & STATUS_KEEP;
+	if ((_shadow & _BV(SHADOW_ON)) && (_status == BUS_OK))
+		_shadow |= _BV(SHADOW_STATUS);
+	return _reg;
+}
+
+// Writes the configuration bits and clears the flags given in clear. OSF is
+// written back as read in config. The alarm flags are written as 1, which
+// leaves them unchanged in the chip.
+void DS3231::_writeStatus(uint8_t config, uint8_t clear)
+{
+	_shadowStatus = config & STATUS_KEEP & ~clear;
+	_writeRegister(REG_STATUS, _shadowStatus | (STATUS_ALARMS & ~clear));
+	if (_status != BUS_OK)
+		_shadow &= ~_BV(SHADOW_STATUS);
+	else if (_shadow & _BV(SHADOW_ON))
+		_shadow |= _BV(SHADOW_STATUS);
+}
+
+// Starts the time budget of a transaction
+void DS3231::_busBegin()
+{
+	_status = BUS_OK;
+	_busStart = micros();
+}
+
+// True, with BUS_TIMEOUT set, when the transaction has used up its budget
+bool DS3231::_busExpired()
+{
+	if ((_timeout == 0) || ((unsigned long)(micros() - _busStart) <= _timeout))
+		return false;
+	_status = BUS_TIMEOUT;
+	return true;
+}
+
+// Blocking transfers must not start while a background transfer owns the
+// bus. Returns false if it did not finish within the budget.
+bool DS3231::_waitForAsync()
+{
+	while (_async == ASYNC_BUSY)
+	{
+		if (_busExpired())
+		{
+			_abortRequest();
+			return false;
+		}
+	}
+	return true;
+}
+
+uint8_t DS3231::_readRegister(uint8_t reg)
+{
+	uint8_t	readValue=0;
+
+	_burstRead(reg, &readValue, 1);
+	return readValue;
+}
+
+void DS3231::_writeRegister(uint8_t reg, uint8_t value)
+{
+	_burstWrite(reg, &value, 1);
+}
+
+// Sends the register address and, for reads, the repeated START with the
+// read address. Returns false if the RTC did not acknowledge.
+bool DS3231::_softSelect(uint8_t reg, bool read)
+{
+	_sendStart(DS3231_ADDR_W);
+	if (!_waitForAck())
+		return false;
+	_writeByte(reg);
+	if (!_waitForAck())
+		return false;
+	if (read)
+	{
+		_sendStart(DS3231_ADDR_R);
+		if (!_waitForAck())
+			return false;
+	}
+	return true;
+}
+
+void DS3231::_softBurstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	_status = BUS_OK;
+	if (_softSelect(reg, true))
+	{
+		for (int i=0; i<count; i++)
+		{
+			buffer[i] = _readByte();
+			if (i<count-1)
+				_sendAck();
+			else
+				_sendNack();
+		}
+	}
+	else
+		_status = BUS_NACK;
+	_sendStop();
+}
+
+void DS3231::_softBurstWrite(uint8_t reg, uint8_t *values, uint8_t count)
+{
+	_status = BUS_OK;
+	if (_softSelect(reg, false))
+	{
+		for (int i=0; i<count; i++)
+		{
+			_writeByte(values[i]);
+			if (!_waitForAck())
+			{
+				_status = BUS_NACK;
+				break;
+			}
+		}
+	}
+	else
+		_status = BUS_NACK;
+	_sendStop();
+}
+
+#if !defined(SOFTI2C_PORTS)
+void	DS3231::_sendStart(byte addr)
+{
+	pinMode(DS3231_SDA, OUTPUT);
+	digitalWrite(DS3231_SDA, HIGH);
+	digitalWrite(DS3231_SCL, HIGH);
+	digitalWrite(DS3231_SDA, LOW);
+	digitalWrite(DS3231_SCL, LOW);
+	shiftOut(DS3231_SDA, DS3231_SCL, MSBFIRST, addr);
+}
+
+void	DS3231::_sendStop()
+{
+	pinMode(DS3231_SDA, OUTPUT);
+	digitalWrite(DS3231_SDA, LOW);
+	digitalWrite(DS3231_SCL, HIGH);
+	digitalWrite(DS3231_SDA, HIGH);
+	pinMode(DS3231_SDA, INPUT);
+}
+
+void	DS3231::_sendNack()
+{
+	pinMode(DS3231_SDA, OUTPUT);
+	digitalWrite(DS3231_SCL, LOW);
+	digitalWrite(DS3231_SDA, HIGH);
+	digitalWrite(DS3231_SCL, HIGH);
+	digitalWrite(DS3231_SCL, LOW);
+	pinMode(DS3231_SDA, INPUT);
+}
+
+void	DS3231::_sendAck()
+{
+	pinMode(DS3231_SDA, OUTPUT);
+	digitalWrite(DS3231_SCL, LOW);
+	digitalWrite(DS3231_SDA, LOW);
+	digitalWrite(DS3231_SCL, HIGH);
+	digitalWrite(DS3231_SCL, LOW);
+	pinMode(DS3231_SDA, INPUT);
+}
+
+// Samples the ACK bit, SDA released by the RTC is a NACK
+bool	DS3231::_waitForAck()
+{
+	bool ack;
+
+	pinMode(DS3231_SDA, INPUT);
+	digitalWrite(DS3231_SCL, HIGH);
+	ack = (digitalRead(DS3231_SDA) == LOW);
+	digitalWrite(DS3231_SCL, LOW);
+	return ack;
+}
+
+uint8_t DS3231::_readByte()
+{
+	pinMode(DS3231_SDA, INPUT);
+
+	uint8_t value = 0;
+	uint8_t currentBit = 0;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		digitalWrite(DS3231_SCL, HIGH);
+		currentBit = digitalRead(DS3231_SDA);
+		value |= (currentBit << 7-i);
+		delayMicroseconds(1);
+		digitalWrite(DS3231_SCL, LOW);
+	}
+	return value;
+}
+
+void DS3231::_writeByte(uint8_t value)
+{
+	pinMode(DS3231_SDA, OUTPUT);
+	shiftOut(DS3231_SDA, DS3231_SCL, MSBFIRST, value);
+}
+#endif
+
+uint8_t	DS3231::_decode(uint8_t value)
+{
+	uint8_t decoded = value & 127;
+	decoded = (decoded & 15) + 10 * ((decoded & (15 << 4)) >> 4);
+	return decoded;
+}
+
+uint8_t DS3231::_decodeH(uint8_t value)
+{
+  if (value & 128)
+    value = (value & 15) + (12 * ((value & 32) >> 5));
+  else
+    value = (value & 15) + (10 * ((value & 48) >> 4));
+  return value;
+}
+
+uint8_t	DS3231::_decodeY(uint8_t value)
+{
+	uint8_t decoded = (value & 15) + 10 * ((value & (15 << 4)) >> 4);
+	return decoded;
+}
+
+uint8_t DS3231::_encode(uint8_t value)
 {
 	uint8_t encoded = ((value / 10) << 4) + (value % 10);
 	return encoded;
 }
 
+
+
+/* Scheduler */
+
+#ifndef DS3231_NO_ALARMS
+
+#define SCHEDULER_FREE	0xFF
+
+DS3231_Scheduler::DS3231_Scheduler(DS3231 &rtc)
+{
+	_rtc = &rtc;
+	_count = 0;
+	_armed = 0;
+	_output = false;
+	_disabled = false;
+	for (uint8_t i=0; i<SCHEDULER_SIZE; i++)
+		_pos[i] = SCHEDULER_FREE;
+}
+
+// Lets Alarm 1 drive the INT/SQW pin. Not needed when checkAlarm() is polled,
+// e.g. together with the soft clock, which needs the pin for the square wave.
+void DS3231_Scheduler::begin()
+{
+	_rtc->setOutput(ALARM1);
+	_output = true;
+	_disabled = false;
+}
+
+// Adds an event due at time, repeated every period seconds if period is not
+// 0. Returns its id, which is also passed to the callback, or -1 if the
+// scheduler is full.
+int8_t DS3231_Scheduler::scheduleAt(unsigned long time, void (*callback)(uint8_t id), unsigned long period)
+{
+	uint8_t	id;
+
+	if (_count == SCHEDULER_SIZE)
+		return -1;
+	for (id=0; _pos[id] != SCHEDULER_FREE; id++) {}
+	_time[id] = time;
+	_period[id] = period;
+	_callback[id] = callback;
+	_heap[_count] = id;
+	_pos[id] = _count;
+	_siftUp(_count++);
+	_arm();
+	return id;
+}
+
+// The same, seconds from now. Also returns -1 if the RTC can not be read.
+int8_t DS3231_Scheduler::scheduleIn(unsigned long seconds, void (*callback)(uint8_t id), unsigned long period)
+{
+	Time	t;
+
+	if (!_rtc->getTime(t))
+		return -1;
+	return scheduleAt(_rtc->getUnixTime(t) + seconds, callback, period);
+}
+
+bool DS3231_Scheduler::cancel(uint8_t id)
+{
+	if ((id >= SCHEDULER_SIZE) || (_pos[id] == SCHEDULER_FREE))
+		return false;
+	_remove(_pos[id]);
+	_arm();
+	return true;
+}
+
+// Call it when Alarm 1 has fired, or poll it. Clears the Alarm 1 flag, runs
+// the callbacks of all events that are due and programs the next one.
+// Returns the number of callbacks run. On a bus error nothing is run and the
+// flag is left set, so the next call tries again.
+uint8_t DS3231_Scheduler::checkAlarm()
+{
+	unsigned long now;
+	uint8_t	id, n = 0;
+	Time	t;
+
+	// Not getBusStatus(): the soft clock serves the time without the bus
+	if (!_rtc->getTime(t))
+		return 0;
+	now = _rtc->getUnixTime(t);
+	_rtc->checkAlarm(1);
+	while (_count && (_time[_heap[0]] <= now))
+	{
+		id = _heap[0];
+		if (_period[id])
+		{
+			// Skip the periods that have been missed entirely
+			_time[id] += ((now - _time[id]) / _period[id] + 1) * _period[id];
+			_siftDown(0);
+		}
+		else
+			_remove(0);
+		_callback[id](id);
+		n++;
+	}
+	_arm();
+	return n;
+}
+
+uint8_t DS3231_Scheduler::pending()
+{
+	return _count;
+}
+
+// Due time of the next event, 0 if there is none
+unsigned long DS3231_Scheduler::nextTime()
+{
+	return _count ? _time[_heap[0]] : 0;
+}
+
+// Programs the nearest event into Alarm 1 with the narrowest mask that still
+// matches it first. An event that is already due is set to the next second.
+// Without events Alarm 1 is disabled, so a stale match can not fire. On a bus
+// error nothing is armed, the next call tries again.
+void DS3231_Scheduler::_arm()
+{
+	unsigned long next, now;
+	ALARM_TYPES_t mask;
+	Time	t;
+
+	if (!_count)
+	{
+		if (_armed)
+		{
+			_rtc->disableAlarm(1);
+			if (_rtc->getBusStatus() == BUS_OK)
+			{
+				_armed = 0;
+				_disabled = true;
+			}
+		}
+		return;
+	}
+	if (_time[_heap[0]] == _armed)
+		return;
+	next = _time[_heap[0]];
+	if (!_rtc->getTime(t))
+		return;
+	now = _rtc->getUnixTime(t);
+	if (next <= now)
+		next = now + 1;
+
+	if (next - now < 60)
+		mask = ALM1_MATCH_SECONDS;
+	else if (next - now < 3600)
+		mask = ALM1_MATCH_MINUTES;
+	else if (next - now < SECS_DAY)
+		mask = ALM1_MATCH_HOURS;
+	else
+		mask = ALM1_MATCH_DATE;		// Further than a month ahead it may fire early, checkAlarm() then re-arms
+	t = _rtc->makeDateTime(next);
+	_rtc->setAlarm(mask, t.sec, t.min, t.hour, t.date);
+	if ((_output) && (_disabled) && (_rtc->getBusStatus() == BUS_OK))
+	{
+		_rtc->setOutput(ALARM1);
+		if (_rtc->getBusStatus() == BUS_OK)
+			_disabled = false;
+	}
+	if (_rtc->getBusStatus() == BUS_OK)
+		_armed = _time[_heap[0]];
+}
+
+void DS3231_Scheduler::_remove(uint8_t pos)
+{
+	_pos[_heap[pos]] = SCHEDULER_FREE;
+	if (pos != --_count)
+	{
+		_heap[pos] = _heap[_count];
+		_pos[_heap[pos]] = pos;
+		_siftDown(pos);
+		_siftUp(pos);
+	}
+}
+
+void DS3231_Scheduler::_swap(uint8_t a, uint8_t b)
+{
+	uint8_t id = _heap[a];
+
+	_heap[a] = _heap[b];
+	_heap[b] = id;
+	_pos[_heap[a]] = a;
+	_pos[_heap[b]] = b;
+}
+
+void DS3231_Scheduler::_siftUp(uint8_t pos)
+{
+	while ((pos > 0) && (_time[_heap[pos]] < _time[_heap[(pos - 1) / 2]]))
+	{
+		_swap(pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+}
+
+void DS3231_Scheduler::_siftDown(uint8_t pos)
+{
+	uint8_t child;
+
+	while ((child = 2 * pos + 1) < _count)
+	{
+		if ((child + 1 < _count) && (_time[_heap[child + 1]] < _time[_heap[child]]))
+			child++;
+		if (_time[_heap[child]] >= _time[_heap[pos]])
+			break;
+		_swap(pos, child);
+		pos = child;
+	}
+}
+#endif
+
+/* Calibration */
+
+#ifndef DS3231_NO_TEMPERATURE
+
+DS3231_Calibration::DS3231_Calibration(DS3231 &rtc)
+{
+	_rtc = &rtc;
+	_started = false;
+	_aging = 0;
+	_last = 0;
+	for (uint8_t i=0; i<CALIBRATION_BINS; i++)
+	{
+		_error[i] = 0;
+		_seconds[i] = 0;
+	}
+}
+
+// Call it with the reference time in ms since the epoch, e.g. after an NTP
+// sync. The error of the RTC since the last call goes into the bin of the
+// mean temperature, and the aging offset of the bin of the current
+// temperature is set. The RTC is read with getUnixTimeMs(), enable the soft
+// clock for sub-second resolution. Intervals under CALIBRATION_MIN_SECONDS
+// are not measured, the next call measures from the same start. Returns
+// false on a bus error, or when the error exceeds CALIBRATION_MAX_ERROR; that
+// interval is dropped and the next one starts here.
+bool DS3231_Calibration::update(uint64_t referenceMs)
+{
+	uint64_t rtcMs;
+	int16_t	temp;
+	int64_t	dRef, e;
+	int32_t	e0;
+	unsigned long secs;
+	uint8_t	b;
+	int8_t	aging;
+
+	if (!_rtc->getUnixTimeMs(rtcMs))
+		return false;
+	temp = _rtc->getTemperatureQuarters();
+	if (!_started)
+		_aging = _rtc->getAgingOffset();
+	else if (referenceMs > _refMs)
+	{
+		dRef = referenceMs - _refMs;
+		secs = dRef / 1000;
+		if ((!secs) || (secs < CALIBRATION_MIN_SECONDS))
+			return true;
+		e = ((int64_t)(rtcMs - _rtcMs) - dRef) * 100000000LL / dRef;
+		if ((e > CALIBRATION_MAX_ERROR) || (e < -CALIBRATION_MAX_ERROR))
+		{
+			_refMs = referenceMs;
+			_rtcMs = rtcMs;
+			_temp = temp;
+			return false;
+		}
+		_last = e;
+
+		// Back to offset 0, each step of the offset slowed the RTC by 0.1 ppm
+		e0 = (int32_t)_last + _aging * 10;
+		b = _bin((temp + _temp) / 2);
+		_error[b] = ((int64_t)_error[b] * _seconds[b] + (int64_t)e0 * secs) / ((int64_t)_seconds[b] + secs);
+		_seconds[b] = (_seconds[b] + secs > CALIBRATION_MEMORY) ? CALIBRATION_MEMORY : _seconds[b] + secs;
+	}
+
+	aging = bestOffset(temp);
+	if (aging != _aging)
+	{
+		_rtc->setAgingOffset(aging);
+		if (_rtc->getBusStatus() == BUS_OK)
+		{
+			_aging = aging;
+			_rtc->startTemperatureConversion();		// Apply it now, not at the next automatic conversion
+		}
+	}
+	_refMs = referenceMs;
+	_rtcMs = rtcMs;
+	_temp = temp;
+	_started = true;
+	return true;
+}
+
+// Starts a new interval with the next update(), e.g. after the RTC has been set
+void DS3231_Calibration::restart()
+{
+	_started = false;
+}
+
+// Error measured over the last interval
+int16_t DS3231_Calibration::getError()
+{
+	return _last;
+}
+
+// Learned error of a bin at aging offset 0
+int16_t DS3231_Calibration::getBinError(uint8_t bin)
+{
+	return (bin < CALIBRATION_BINS) ? _error[bin] : 0;
+}
+
+unsigned long DS3231_Calibration::getBinSeconds(uint8_t bin)
+{
+	return (bin < CALIBRATION_BINS) ? _seconds[bin] : 0;
+}
+
+// The aging offset for a temperature in 1/4 C. Until its bin has been
+// observed for CALIBRATION_MIN_SPAN seconds, the offset is left as it is.
+int8_t DS3231_Calibration::bestOffset(int16_t temperature)
+{
+	uint8_t	b = _bin(temperature);
+	int16_t	offset;
+
+	if (_seconds[b] < CALIBRATION_MIN_SPAN)
+		return _aging;
+	offset = (_error[b] + ((_error[b] >= 0) ? 5 : -5)) / 10;
+	if (offset > 127)
+		offset = 127;
+	else if (offset < -127)
+		offset = -127;
+	return offset;
+}
+
+uint8_t DS3231_Calibration::_bin(int16_t temperature)
+{
+	int16_t b = (temperature - CALIBRATION_BIN_MIN * 4) / (CALIBRATION_BIN_WIDTH * 4);
+
+	if (temperature < CALIBRATION_BIN_MIN * 4)
+		return 0;
+	return (b >= CALIBRATION_BINS) ? CALIBRATION_BINS - 1 : b;
+}
+#endif
+
+/* Drift estimator */
+
+DS3231_Drift::DS3231_Drift(DS3231 &rtc)
+{
+	_rtc = &rtc;
+	restart();
+}
+
+// Takes a sample of the RTC against the reference time in ms since the
+// epoch. The RTC is read with getUnixTimeMs(), enable the soft clock for
+// sub-second resolution. Returns false on a bus error.
+bool DS3231_Drift::sample(uint64_t referenceMs)
+{
+	uint64_t rtcMs;
+
+	if (!_rtc->getUnixTimeMs(rtcMs))
+		return false;
+	addSample(referenceMs, rtcMs);
+	return true;
+}
+
+// Adds a sample taken elsewhere, e.g. latched with a PPS interrupt. The
+// deviations from the running means are accumulated (Welford), which keeps
+// the fit accurate with float on AVR.
+void DS3231_Drift::addSample(uint64_t referenceMs, uint64_t rtcMs)
+{
+	double	x, y, dx, dy;
+
+	if (_n == 0)
+		_ref0 = referenceMs;
+	x = (double)(int64_t)(referenceMs - _ref0) / 1000.0;
+	y = (double)((int64_t)rtcMs - (int64_t)referenceMs);
+	if (_n < 0xFFFF)
+		_n++;
+	dx = x - _mx;
+	dy = y - _my;
+	_mx += dx / _n;
+	_my += dy / _n;
+	_cxx += dx * (x - _mx);
+	_cxy += dx * (y - _my);
+	_cyy += dy * (y - _my);
+	_x = x;
+}
+
+// Forgets all samples, e.g. after the RTC has been set
+void DS3231_Drift::restart()
+{
+	_ref0 = 0;
+	_n = 0;
+	_x = 0;
+	_mx = 0;
+	_my = 0;
+	_cxx = 0;
+	_cxy = 0;
+	_cyy = 0;
+}
+
+// Offset of the RTC in ms at x seconds after the first sample
+double DS3231_Drift::_offsetAt(double x)
+{
+	if (_n < 2 || _cxx <= 0)
+		return _my;
+	return _my + _cxy / _cxx * (x - _mx);
+}
+
+// Removes the fitted offset and drift from an RTC time in ms
+uint64_t DS3231_Drift::correct(uint64_t rtcMs)
+{
+	double	offset;
+
+	if (_n == 0)
+		return rtcMs;
+	offset = _offsetAt((double)(int64_t)(rtcMs - _ref0) / 1000.0);
+	return rtcMs - (int64_t)(offset + ((offset >= 0) ? 0.5 : -0.5));
+}
+
+uint64_t DS3231_Drift::correctedUnixTimeMs()
+{
+	return correct(_rtc->getUnixTimeMs());
+}
+
+unsigned long DS3231_Drift::correctedUnixTime()
+{
+	return correctedUnixTimeMs() / 1000;
+}
+
+uint16_t DS3231_Drift::samples()
+{
+	return _n;
+}
+
+// Fitted offset of the RTC at the last sample in ms, positive when ahead
+float DS3231_Drift::getOffset()
+{
+	return _offsetAt(_x);
+}
+
+// Fitted frequency error in ppm, positive when the RTC runs fast
+float DS3231_Drift::getDrift()
+{
+	if (_n < 2 || _cxx <= 0)
+		return 0;
+	return _cxy / _cxx * 1000.0;
+}
+
+// Standard error of the drift in ppm, 0 with less than three samples
+float DS3231_Drift::getDriftError()
+{
+	if (_n < 3 || _cxx <= 0)
+		return 0;
+	return sqrt(getResidual() * getResidual() / _cxx) * 1000.0;
+}
+
+// Standard deviation of the samples from the fit in ms, i.e. the jitter of
+// the reference and of the RTC readout
+float DS3231_Drift::getResidual()
+{
+	double	sse;
+
+	if (_n < 3 || _cxx <= 0)
+		return 0;
+	sse = _cyy - _cxy * _cxy / _cxx;
+	return (sse > 0) ? sqrt(sse / (_n - 2)) : 0;
+}
+
+// Seconds after the last sample that correctedUnixTimeMs() stays within
+// maxErrorMs with about 95% confidence (two standard errors), e.g. the next
+// resync interval. 0 if there are not enough samples or the budget is too
+// tight for the jitter.
+unsigned long DS3231_Drift::holdover(float maxErrorMs)
+{
+	double	sigma, slope, t;
+
+	if (_n < 3 || _cxx <= 0)
+		return 0;
+	sigma = getResidual() / sqrt((double)_n);			// Of the fitted offset at the mean
+	slope = getDriftError() / 1000.0;					// In ms per second
+	if (maxErrorMs / 2 <= sigma)
+		return 0;
+	if (slope <= 0)
+		return 0xFFFFFFFFUL;
+	t = (maxErrorMs / 2 - sigma) / slope - (_x - _mx);
+	if (t <= 0)
+		return 0;
+	return (t >= 4294967295.0) ? 0xFFFFFFFFUL : (unsigned long)t;
+}
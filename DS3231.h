@@ -22,7 +22,21 @@
 #ifndef DS3231_h
 #define DS3231_h
 
-#if defined(__AVR__)
+// Uncomment to leave parts of the library out of the build on flash-bound
+// boards. Their functions are then not declared, so a sketch that uses them
+// does not compile. DS3231_BUS_HW in hardware/<platform>/HW_*_defines.h
+// leaves out the software I2C in the same way. extras/footprint.sh shows
+// what each switch saves.
+//#define DS3231_NO_FORMAT		// getTimeStr() and the other string functions, format*()
+//#define DS3231_NO_ALARMS		// setAlarm*(), checkAlarm(), DS3231_Scheduler
+//#define DS3231_NO_TEMPERATURE	// getTemperature() and the conversions, DS3231_Calibration
+//#define DS3231_NO_DOW			// Day of the week calculation of setDOW() and setDateTime()
+
+#if defined(DS3231_HOST)
+	#include "hardware/host/HW_HOST_defines.h"
+#elif defined(DS3231_LINUX)
+	#include "hardware/linux/HW_LINUX_defines.h"
+#elif defined(__AVR__)
 	#include "Arduino.h"
 	#include "hardware/avr/HW_AVR_defines.h"
 #elif defined(__PIC32MX__)
@@ -33,10 +47,84 @@
 	#include "hardware/arm/HW_ARM_defines.h"
 #endif
 
+// Bus selection, see the HW_*_defines.h files. Without either switch begin()
+// chooses between the hardware and the software I2C at run time.
+#if defined(DS3231_BUS_HW) && defined(DS3231_BUS_SOFT)
+	#error "Define only one of DS3231_BUS_HW and DS3231_BUS_SOFT"
+#elif defined(DS3231_BUS_HW)
+	#define DS3231_USE_HW	true
+#elif defined(DS3231_BUS_SOFT)
+	#if !defined(DS3231_SDA_PIN) || !defined(DS3231_SCL_PIN)
+		#error "DS3231_BUS_SOFT needs DS3231_SDA_PIN and DS3231_SCL_PIN"
+	#endif
+	#define DS3231_USE_HW	false
+#else
+	#define DS3231_USE_HW	_use_hw
+#endif
+
 #define DS3231_ADDR_R	0xD1
 #define DS3231_ADDR_W	0xD0
 #define DS3231_ADDR		0x68
 
+// Background transfer states
+#define ASYNC_IDLE	0
+#define ASYNC_BUSY	1
+#define ASYNC_DONE	2
+#define ASYNC_ERROR	3
+
+// Bus transaction status, see getBusStatus()
+#define BUS_OK		0
+#define BUS_TIMEOUT	1	// The bus did not finish in time
+#define BUS_NACK	2	// The RTC did not acknowledge
+#define BUS_ERROR	3	// Bus error or lost arbitration
+
+#ifndef DS3231_BUS_TIMEOUT
+	#define DS3231_BUS_TIMEOUT	10000L	// Default time budget of one transaction in us
+#endif
+
+#ifndef SOFTCLOCK_RESYNC
+	#define SOFTCLOCK_RESYNC	3600	// Default soft clock resync interval in seconds
+#endif
+#ifndef SOFTCLOCK_STALE_MS
+	#define SOFTCLOCK_STALE_MS	1500	// No SQW edge for this long and the soft clock reads the RTC
+#endif
+
+#ifndef TEMP_CACHE_MS
+	#define TEMP_CACHE_MS	64000L	// Lifetime of the cached temperature from its read, one conversion period
+#endif
+
+#ifndef CALIBRATION_BINS
+	#define CALIBRATION_BINS		8		// Temperature bins of a DS3231_Calibration
+#endif
+#ifndef CALIBRATION_BIN_MIN
+	#define CALIBRATION_BIN_MIN		-5		// Lower edge of the first bin in C
+#endif
+#ifndef CALIBRATION_BIN_WIDTH
+	#define CALIBRATION_BIN_WIDTH	5		// Width of a bin in C
+#endif
+#ifndef CALIBRATION_MIN_SPAN
+	#define CALIBRATION_MIN_SPAN	86400L	// Seconds observed before a bin sets the aging offset
+#endif
+#ifndef CALIBRATION_MIN_SECONDS
+	#define CALIBRATION_MIN_SECONDS	3600L	// Shorter intervals are not measured, the baseline is kept
+#endif
+#ifndef CALIBRATION_MAX_ERROR
+	#define CALIBRATION_MAX_ERROR	3000	// Larger errors in 1/100 ppm are steps of a clock, not drift
+#endif
+#ifndef CALIBRATION_MEMORY
+	#define CALIBRATION_MEMORY		2592000L	// Observation weight limit in seconds, so a bin follows aging
+#endif
+
+#ifndef SCHEDULER_SIZE
+	#define SCHEDULER_SIZE	16	// Events a DS3231_Scheduler can hold
+#endif
+
+#define DATETIME_STR_LEN	20	// Record length of formatDateTime()
+#define TIME_STR_LEN		9	// Buffer length for formatTime()
+#define DATE_STR_LEN		11	// Buffer length for formatDate()
+#define ISO8601_STR_LEN		30	// Buffer length for formatISO8601(), "yyyy-mm-ddThh:mm:ss.sss+hh:mm"
+#define NAME_STR_LEN		10	// Buffer length for formatDOW() and formatMonth()
+
 #define FORMAT_SHORT	1
 #define FORMAT_LONG		2
 
@@ -99,57 +187,385 @@ public:
 	Time();
 };
 
+// An alarm as set with DS3231::setAlarm()
+class DS3231Alarm
+{
+public:
+	ALARM_TYPES_t	type;
+	uint8_t		sec;		// Always 0 for Alarm 2
+	uint8_t		min;
+	uint8_t		hour;
+	uint8_t		daydate;	// Day of the week with the ALMx_MATCH_DAY types, else date
+};
+
+// The whole register file, see DS3231::readAll()
+class DS3231State
+{
+public:
+	Time		time;
+#ifndef DS3231_NO_ALARMS
+	DS3231Alarm	alarm1;
+	DS3231Alarm	alarm2;
+#endif
+	uint8_t		control;		// Control register (0x0E)
+	uint8_t		status;			// Status register (0x0F), e.g. OSF, BSY, A2F, A1F
+	int8_t		aging;			// Aging offset
+#ifndef DS3231_NO_TEMPERATURE
+	float		temperature;	// From the last conversion in C
+#endif
+};
+
+#define DS3231_REGS	0x13	// Registers 0x00 - 0x12
+
+// Sequence counter for data that one writer, e.g. an interrupt, shares with
+// readers without disabling interrupts. The writer brackets its update with
+// beginWrite() and endWrite(). A reader copies the data after beginRead()
+// and copies it again as long as retry() returns true. Readers must not
+// preempt the writer, they would retry forever.
+class SeqLock
+{
+public:
+	SeqLock();
+	void	beginWrite();
+	void	endWrite();
+	uint8_t	beginRead();
+	bool	retry(uint8_t seq);
+
+private:
+	volatile uint8_t _seq;
+};
+
+// Soft clock state, see DS3231::getSnapshot()
+class TimeSnapshot
+{
+public:
+	Time			time;		// Current time of the soft clock
+	unsigned long	unixTime;	// The same as Unix time
+	unsigned long	sqwMicros;	// micros() at the last SQW edge
+	int16_t			drift;		// MCU clock error against the RTC in ppm
+	bool			sqwValid;	// sqwMicros is in phase with the RTC seconds
+};
+
 class DS3231
 {
 	public:
 		DS3231(uint8_t data_pin, uint8_t sclk_pin);
+#if defined(DS3231_LINUX)
+		~DS3231();
+#endif
 		void	begin();
 		Time	getTime();
+		bool	getTime(Time &t);
 		void	setTime(uint8_t sec, uint8_t min, uint8_t hour);
 		void	setDate(uint8_t date, uint8_t mon, uint16_t year, uint16_t epochYear = 1970);
 		void	setDateTime(Time t, uint16_t epochYear = 1970);
 		void	setDateTime(uint8_t sec, uint8_t min, uint8_t hour, uint8_t date, uint8_t mon, uint16_t year, uint16_t epochYear = 1970);
+#ifndef DS3231_NO_DOW
 		void	setDOW();
+#endif
 		void	setDOW(uint8_t dow);
 		Time	makeDateTime(unsigned long time);
+		Time	makeDateTime64(uint64_t time);
+#ifndef DS3231_NO_ALARMS
 		void	setAlarm(ALARM_TYPES_t alarmType, uint8_t sec, uint8_t min, uint8_t hour, uint8_t daydate);
+		bool	setAlarmAt(unsigned long time, ALARM_TYPES_t alarmType=ALM1_MATCH_DATE);
+		bool	setAlarmIn(unsigned long seconds, ALARM_TYPES_t alarmType=ALM1_MATCH_DATE);
 		uint8_t	checkAlarm(void);
+		uint8_t	checkAlarm(uint8_t alarms);
+		void	disableAlarm(uint8_t alarms);
+#endif
 
+#ifndef DS3231_NO_FORMAT
 		char	*getTimeStr(uint8_t format=FORMAT_LONG);
 		char	*getDateStr(uint8_t slformat=FORMAT_LONG, uint8_t eformat=FORMAT_LITTLEENDIAN, char divider='.');
 		char	*getDOWStr(uint8_t format=FORMAT_LONG);
 		char	*getMonthStr(uint8_t format=FORMAT_LONG);
+		char	*getTimeStr(Time t, uint8_t format=FORMAT_LONG);
+		char	*getDateStr(Time t, uint8_t slformat=FORMAT_LONG, uint8_t eformat=FORMAT_LITTLEENDIAN, char divider='.');
+		char	*getDOWStr(Time t, uint8_t format=FORMAT_LONG);
+		char	*getMonthStr(Time t, uint8_t format=FORMAT_LONG);
+		static size_t formatTime(Time t, char *buffer, uint8_t format=FORMAT_LONG);
+		static size_t formatDate(Time t, char *buffer, uint8_t slformat=FORMAT_LONG, uint8_t eformat=FORMAT_LITTLEENDIAN, char divider='.', uint16_t epochYear=1970);
+		static size_t formatISO8601(Time t, char *buffer, int16_t msec=-1, int16_t tzMinutes=0);
+		static size_t formatDOW(uint8_t dow, char *buffer, uint8_t format=FORMAT_LONG);
+		static size_t formatMonth(uint8_t mon, char *buffer, uint8_t format=FORMAT_LONG);
+		size_t	formatISO8601(char *buffer, bool msec=false, int16_t tzMinutes=0);
+#endif
 		unsigned long getUnixTime();
 		unsigned long getUnixTime(Time t);
+		uint64_t getUnixTime64(Time t);
+
+		void	makeDateTime(const unsigned long *time, Time *t, size_t count);
+		void	getUnixTime(const Time *t, unsigned long *time, size_t count);
+#ifndef DS3231_NO_FORMAT
+		void	formatDateTime(const unsigned long *time, char *buffer, size_t count, uint8_t eformat=FORMAT_LITTLEENDIAN, char divider='.');
+#endif
+
+		static long	daysFromCivil(uint16_t year, uint8_t mon, uint8_t date);
+		static void	civilFromDays(long days, Time &t);
 
 		void	enable32KHz(bool enable);
 		void	setOutput(MODES_t mode);
 		void	setSQWRate(SQWAVE_FREQS_t rate);
+#ifndef DS3231_NO_TEMPERATURE
 		float	getTemperature();
+		int16_t	getTemperatureQuarters();
+#endif
+		int8_t	getAgingOffset();
+		void	setAgingOffset(int8_t offset);
+#ifndef DS3231_NO_TEMPERATURE
+		bool	startTemperatureConversion();
+		bool	temperatureReady();
+		float	readTemperature();
+#endif
+		bool	readAll(DS3231State &s);
+		void	decodeState(uint8_t *regs, DS3231State &s);
+
+		void	enableRegisterCache(bool enable);
+		void	invalidateRegisterCache();
+		void	refreshRegisterCache();
+
+		void	enableSoftClock(bool enable, uint16_t resync=SOFTCLOCK_RESYNC);
+		bool	syncSoftClock();
+		void	tick();		// Call from the SQW falling edge interrupt
+		uint32_t getTimeMicros(Time &t);
+		uint64_t getUnixTimeMs();
+		bool	getUnixTimeMs(uint64_t &ms);
+		int16_t	getMCUDrift();
+		bool	getSnapshot(TimeSnapshot &s);
+
+		void	setBusTimeout(unsigned long usec);
+		uint8_t	getBusStatus();
+
+		bool	requestTime();
+		bool	requestRegisters(uint8_t reg, uint8_t *buffer, uint8_t count);
+		bool	isReady();
+		Time	getRequestedTime();
+		void	onTimeReady(void (*callback)(Time t));
+
+#if defined(__AVR__)
+		void	setSoftwareI2CFreq(unsigned long freq);
+#endif
+
+#if defined(__AVR__) || (defined(__arm__) && !defined(DS3231_HOST) && !defined(DS3231_LINUX))
+		void	_twiISR();	// Called from the TWI interrupt, not for public use
+#endif
 
 	private:
+#if !defined(DS3231_BUS_SOFT)
 		uint8_t _scl_pin;
 		uint8_t _sda_pin;
+#endif
 		uint8_t _burstArray[7];
+#if !defined(DS3231_BUS_HW) && !defined(DS3231_BUS_SOFT)
 		boolean	_use_hw;
+#endif
 		uint16_t YEAR0 = 1970; // 1970 or 2000 or user defined
+		uint8_t	_shadow;		// Register cache state (enabled/valid bits)
+		uint8_t	_shadowCon;		// Cached REG_CON (CONV always clear)
+		uint8_t	_shadowStatus;	// Cached configuration bits of REG_STATUS
+		volatile uint8_t _async;	// Background transfer state
+		bool	_asyncTime;			// Background transfer is a requestTime()
+		void	(*_timeCallback)(Time t);
+		TimeSnapshot _soft;			// Soft clock, advanced by tick()
+		SeqLock	_softLock;			// Guards _soft
+		uint16_t _softResync;		// Resync interval in seconds, 0 = soft clock off
+		uint16_t _softAge;			// Seconds since the last resync
+		volatile bool _softDue;		// Resync on the next read
+		unsigned long _softEdge;	// millis() at the last SQW edge, guarded by _softLock
+		unsigned long _sqwBase;		// micros() at the start of the drift window
+		uint8_t	_sqwCount;			// SQW edges in the drift window
+#ifndef DS3231_NO_TEMPERATURE
+		int16_t	_temp;				// Cached temperature in 1/4 C
+		bool	_tempValid;
+		unsigned long _tempTime;	// millis() when _temp was read
+#endif
+		uint8_t	_status;			// Status of the last transaction
+		unsigned long _timeout;		// Transaction budget in us, 0 waits forever
+		unsigned long _busStart;	// micros() at the start of the transaction
 
 		void	_sendStart(byte addr);
 		void	_sendStop();
 		void	_sendAck();
 		void	_sendNack();
-		void	_waitForAck();
+		bool	_waitForAck();
 		uint8_t	_readByte();
 		void	_writeByte(uint8_t value);
-		void	_burstRead();
+		void	_burstRead(uint8_t reg, uint8_t *buffer, uint8_t count);
 		uint8_t	_readRegister(uint8_t reg);
 		void 	_writeRegister(uint8_t reg, uint8_t value);
+		void	_burstWrite(uint8_t reg, uint8_t *values, uint8_t count);
+		bool	_softSelect(uint8_t reg, bool read);
+		void	_softBurstRead(uint8_t reg, uint8_t *buffer, uint8_t count);
+		void	_softBurstWrite(uint8_t reg, uint8_t *values, uint8_t count);
+		void	_busBegin();
+		bool	_busExpired();
+		void	_busReset();
+		bool	_waitForAsync();
+		void	_abortRequest();
+		bool	_softRead(Time &t, unsigned long &time);
+		void	_softInvalidate();
+		bool	_softStale();
+		void	_softRelease(uint8_t control);
+		bool	_readMicros(Time &t, unsigned long &time, uint32_t &usec);
+		bool	_request(uint8_t reg, uint8_t *buffer, uint8_t count, bool time);
+		bool	_startBurstRead(uint8_t reg, uint8_t *buffer, uint8_t count);
+		void	_burstDone(bool ok);
+		Time	_decodeTime();
+		Time	_decodeTime(uint8_t *regs);
+#ifndef DS3231_NO_ALARMS
+		void	_decodeAlarm(uint8_t *regs, uint8_t alarm, DS3231Alarm &a);
+#endif
+#ifndef DS3231_NO_TEMPERATURE
+		int16_t	_decodeTemperature(uint8_t *regs);
+		void	_setTemperature(uint8_t *regs);
+#endif
+		uint8_t	_readControl();
+		void	_writeControl(uint8_t value);
+		uint8_t	_readStatus();
+		void	_writeStatus(uint8_t config, uint8_t clear);
 		uint8_t	_decode(uint8_t value);
 		uint8_t	_decodeH(uint8_t value);
 		uint8_t	_decodeY(uint8_t value);
 		uint8_t	_encode(uint8_t vaule);
-#if defined(__arm__)
+#ifndef DS3231_NO_DOW
+		uint8_t	_calcDOW(uint8_t date, uint8_t mon, uint16_t year);
+#endif
+		Time	_makeDateTime(long days, unsigned long dayclock);
+#ifndef DS3231_NO_ALARMS
+		void	_encodeAlarm(ALARM_TYPES_t alarmType, uint8_t sec, uint8_t min, uint8_t hour, uint8_t daydate, uint8_t *regs);
+#endif
+		void	_setDateTime(uint8_t sec, uint8_t min, uint8_t hour, uint8_t date, uint8_t mon, uint16_t year, uint8_t dow, uint16_t epochYear);
+#if defined(__AVR__) || (defined(__arm__) && !defined(DS3231_HOST) && !defined(DS3231_LINUX))
+		uint8_t	*_twiBuffer;
+		uint8_t	_twiCount;
+#endif
+#if defined(__AVR__)
+		uint8_t	_twiCommand(uint8_t twcr);
+		bool	_twiSelect(uint8_t reg, bool read);
+		void	_twiFail(uint8_t twst);
+		uint8_t	_twiReg;
+		uint8_t	_twiIndex;
+		volatile uint8_t *_sdaMode;
+		volatile uint8_t *_sdaIn;
+		volatile uint8_t *_sclOut;
+		uint8_t	_sdaMask;
+		uint8_t	_sclMask;
+		uint8_t	_bitDelay;
+#endif
+#if defined(__arm__) && !defined(DS3231_HOST) && !defined(DS3231_LINUX)
+		bool	_twiWait(uint32_t flag);
 		Twi		*twi;
 #endif
+#if defined(__PIC32MX__)
+		bool	_i2cWait(uint32_t conBit);
+		bool	_i2cSend(uint8_t value);
+		bool	_i2cSelect(uint8_t reg, bool read);
+#endif
+#if defined(DS3231_LINUX)
+		int		_fd;				// File descriptor of /dev/i2c-N
+		pthread_mutex_t	_softMutex;	// Keeps tick() and the other soft clock writers apart
+		bool	_i2cTransfer(struct i2c_msg *msgs, uint8_t count);
+		DS3231(const DS3231 &);		// Not copyable, both copies would close _fd
+		DS3231 &operator=(const DS3231 &);
+#endif
+};
+
+#ifndef DS3231_NO_ALARMS
+// Any number of timed events, up to SCHEDULER_SIZE, on Alarm 1. The events
+// are kept in a min-heap ordered by time and the nearest one is always
+// programmed into Alarm 1, so the MCU can sleep until exactly the next
+// deadline. Times are Unix times as returned by DS3231::getUnixTime().
+class DS3231_Scheduler
+{
+	public:
+		DS3231_Scheduler(DS3231 &rtc);
+		void	begin();
+		int8_t	scheduleAt(unsigned long time, void (*callback)(uint8_t id), unsigned long period=0);
+		int8_t	scheduleIn(unsigned long seconds, void (*callback)(uint8_t id), unsigned long period=0);
+		bool	cancel(uint8_t id);
+		uint8_t	checkAlarm();
+		uint8_t	pending();
+		unsigned long nextTime();
+
+	private:
+		DS3231	*_rtc;
+		unsigned long _time[SCHEDULER_SIZE];	// Due time of each event
+		unsigned long _period[SCHEDULER_SIZE];	// Repeat period in seconds, 0 = once
+		void	(*_callback[SCHEDULER_SIZE])(uint8_t id);
+		uint8_t	_heap[SCHEDULER_SIZE];			// Event ids as a min-heap on _time
+		uint8_t	_pos[SCHEDULER_SIZE];			// Heap position of each id, SCHEDULER_FREE if unused
+		uint8_t	_count;
+		unsigned long _armed;					// Time programmed into Alarm 1, 0 = none
+		bool	_output;						// begin() let Alarm 1 drive the INT/SQW pin
+		bool	_disabled;						// Alarm 1 was disabled when the last event went
+
+		void	_arm();
+		void	_remove(uint8_t pos);
+		void	_swap(uint8_t a, uint8_t b);
+		void	_siftUp(uint8_t pos);
+		void	_siftDown(uint8_t pos);
+};
+#endif
+
+#ifndef DS3231_NO_TEMPERATURE
+// Learns the frequency error of the RTC against a reference clock, e.g. NTP
+// or GPS, per temperature bin and sets the aging offset that cancels it.
+// Errors are in 1/100 ppm, positive when the RTC runs fast.
+class DS3231_Calibration
+{
+	public:
+		DS3231_Calibration(DS3231 &rtc);
+		bool	update(uint64_t referenceMs);
+		void	restart();
+		int16_t	getError();
+		int16_t	getBinError(uint8_t bin);
+		unsigned long getBinSeconds(uint8_t bin);
+		int8_t	bestOffset(int16_t temperature);
+
+	private:
+		DS3231	*_rtc;
+		int16_t	_error[CALIBRATION_BINS];		// Error at aging offset 0
+		unsigned long _seconds[CALIBRATION_BINS];	// Observation time behind _error
+		uint64_t _refMs;			// Reference time at the start of the interval
+		uint64_t _rtcMs;			// RTC time at the start of the interval
+		int16_t	_temp;				// Temperature at the start in 1/4 C
+		int8_t	_aging;				// Aging offset in effect since the start
+		bool	_started;
+		int16_t	_last;				// Error of the last interval
+
+		uint8_t	_bin(int16_t temperature);
+};
+#endif
+
+// Fits the offset and the frequency error of the RTC against a reference
+// clock, e.g. GPS PPS or NTP, by least squares over all samples. The fit is
+// updated with each sample and needs no sample history.
+class DS3231_Drift
+{
+	public:
+		DS3231_Drift(DS3231 &rtc);
+		bool	sample(uint64_t referenceMs);
+		void	addSample(uint64_t referenceMs, uint64_t rtcMs);
+		void	restart();
+		uint64_t correct(uint64_t rtcMs);
+		uint64_t correctedUnixTimeMs();
+		unsigned long correctedUnixTime();
+		uint16_t samples();
+		float	getOffset();
+		float	getDrift();
+		float	getDriftError();
+		float	getResidual();
+		unsigned long holdover(float maxErrorMs);
+
+	private:
+		DS3231	*_rtc;
+		uint64_t _ref0;				// Reference time of the first sample, origin of x
+		uint16_t _n;
+		double	_x;					// Seconds since the first sample at the last sample
+		double	_mx, _my;			// Means of x and of the offset y in ms
+		double	_cxx, _cxy, _cyy;	// Sums of the products of the deviations
+
+		double	_offsetAt(double x);
 };
 #endif
@@ -0,0 +1,73 @@
+// DS3231_Async
+//
+// A quick demo of how to use my DS3231-library to read the time in the
+// background while the main loop keeps doing other work.
+//
+// On AVR boards the transfer runs from the TWI interrupt when DS3231_ASYNC
+// is defined (see hardware/avr/HW_AVR_defines.h). The interrupt handler
+// conflicts with the Wire library, so do not use both in one sketch. On
+// other boards, or without DS3231_ASYNC, requestTime() reads the time
+// right away and the sketch works the same, just without the overlap.
+//
+// To use the hardware I2C (TWI) interface of the Arduino you must connect
+// the pins as follows:
+//
+// Arduino Uno/2009:
+// ----------------------
+// DS3231:  SDA pin   -> Arduino Analog 4 or the dedicated SDA pin
+//          SCL pin   -> Arduino Analog 5 or the dedicated SCL pin
+//
+// Arduino Mega:
+// ----------------------
+// DS3231:  SDA pin   -> Arduino Digital 20 (SDA) or the dedicated SDA pin
+//          SCL pin   -> Arduino Digital 21 (SCL) or the dedicated SCL pin
+//
+
+#include <DS3231.h>
+
+// Init the DS3231 using the hardware interface
+DS3231  rtc(SDA, SCL);
+
+volatile bool timeReady = false;
+unsigned long samples = 0;
+
+// Runs when the background transfer has completed. With DS3231_ASYNC this
+// is called from the interrupt, so only set a flag here.
+void timeDone(Time t)
+{
+  timeReady = true;
+}
+
+void setup()
+{
+  // Setup Serial connection
+  Serial.begin(115200);
+
+  // Initialize the rtc object
+  rtc.begin();
+  rtc.onTimeReady(timeDone);
+
+  // Start the first transfer
+  rtc.requestTime();
+}
+
+void loop()
+{
+  // Keep sampling while the RTC transfer runs
+  analogRead(A0);
+  samples++;
+
+  if (timeReady)
+  {
+    timeReady = false;
+    Time t = rtc.getRequestedTime();
+
+    Serial.print(rtc.getTimeStr(t));
+    Serial.print("  samples: ");
+    Serial.println(samples);
+    samples = 0;
+
+    delay(1000);
+    rtc.requestTime();
+  }
+}
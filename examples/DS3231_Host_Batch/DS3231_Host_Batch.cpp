@@ -0,0 +1,124 @@
+// DS3231_Host_Batch
+//
+// A host-side (Linux/desktop) program that measures the throughput of the
+// batch conversions makeDateTime(array), getUnixTime(array) and
+// formatDateTime() against calling makeDateTime(), getUnixTime() and
+// getDateStr()/getTimeStr() once per value, and checks that both give the
+// same results.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -O3 -march=native -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_Batch.cpp -o batch
+//   ./batch
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <DS3231.h>
+
+#define COUNT   1000000
+#define ROUNDS  10
+
+DS3231  rtc(SDA, SCL);
+
+static unsigned long  unixIn[COUNT], unixOut[COUNT];
+static Time           times[COUNT];
+static char           text[COUNT * DATETIME_STR_LEN];
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double scalar, double batch)
+{
+  double n = (double)COUNT * ROUNDS;
+  printf("%-22s %12.0f %12.0f %8.1fx\n", name, n / scalar, n / batch, scalar / batch);
+}
+
+int main()
+{
+  double t0, scalar, batch;
+  unsigned long sum = 0;
+
+  // Logged timestamps spread over 1970 - 2105
+  srand(1);
+  for (int i = 0; i < COUNT; i++)
+    unixIn[i] = ((unsigned long)rand() * 2 + (rand() & 1)) & 0xFFFFFFFFUL;
+
+  printf("%-22s %12s %12s %9s\n", "conversions/s", "per call", "batch", "speedup");
+
+  // unix -> Time
+  t0 = now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < COUNT; i++)
+    {
+      times[i] = rtc.makeDateTime(unixIn[i]);
+      sum += times[i].date;
+    }
+  scalar = now() - t0;
+  t0 = now();
+  for (int r = 0; r < ROUNDS; r++)
+  {
+    rtc.makeDateTime(unixIn, times, COUNT);
+    sum += times[r].date;
+  }
+  batch = now() - t0;
+  report("unix -> Time", scalar, batch);
+
+  // Time -> unix
+  t0 = now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < COUNT; i++)
+      sum += unixOut[i] = rtc.getUnixTime(times[i]);
+  scalar = now() - t0;
+  t0 = now();
+  for (int r = 0; r < ROUNDS; r++)
+  {
+    rtc.getUnixTime(times, unixOut, COUNT);
+    sum += unixOut[r];
+  }
+  batch = now() - t0;
+  report("Time -> unix", scalar, batch);
+
+  // unix -> text
+  t0 = now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < COUNT; i++)
+    {
+      Time t = rtc.makeDateTime(unixIn[i]);
+      char *out = text + i * DATETIME_STR_LEN;
+      memcpy(out, rtc.getDateStr(t), 10);
+      out[10] = ' ';
+      memcpy(out + 11, rtc.getTimeStr(t), 9);
+    }
+  scalar = now() - t0;
+  t0 = now();
+  for (int r = 0; r < ROUNDS; r++)
+    rtc.formatDateTime(unixIn, text, COUNT);
+  batch = now() - t0;
+  report("unix -> text", scalar, batch);
+
+  // Both paths must agree
+  int errors = 0;
+  rtc.makeDateTime(unixIn, times, COUNT);
+  rtc.getUnixTime(times, unixOut, COUNT);
+  rtc.formatDateTime(unixIn, text, COUNT);
+  for (int i = 0; i < COUNT; i++)
+  {
+    Time t = rtc.makeDateTime(unixIn[i]);
+    if ((t.year != times[i].year) || (t.mon != times[i].mon) || (t.date != times[i].date) ||
+        (t.hour != times[i].hour) || (t.min != times[i].min) || (t.sec != times[i].sec) ||
+        (t.dow != times[i].dow) || (unixOut[i] != unixIn[i]) ||
+        strncmp(text + i * DATETIME_STR_LEN, rtc.getDateStr(t), 10) ||
+        strcmp(text + i * DATETIME_STR_LEN + 11, rtc.getTimeStr(t)))
+      errors++;
+  }
+  printf("\nmismatches: %d (checksum %lu)\n", errors, sum);
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+// DS3231_Host_BusCost
+//
+// A host-side (Linux/desktop) program that runs the library against the
+// simulated DS3231 in hardware/host and reports what each library call
+// costs on the I2C bus: START/STOP conditions, bytes, SCL cycles and the
+// resulting bus time at TWI_FREQ.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_BusCost.cpp -o buscost
+//   ./buscost
+//
+
+#include <stdio.h>
+#include <DS3231.h>
+
+DS3231  rtc(SDA, SCL);
+
+// The simulated INT/SQW pin interrupt
+static void onSQW()
+{
+  rtc.tick();
+}
+
+static void report(const char *name)
+{
+  printf("%-38s %6u %6u %6u %6u %8u\n", name,
+    (unsigned)DS3231_sim.starts, (unsigned)DS3231_sim.stops,
+    (unsigned)DS3231_sim.bytes, (unsigned)DS3231_sim.sclCycles,
+    (unsigned)DS3231_sim.busTimeUs());
+  DS3231_sim.resetCounters();
+}
+
+int main()
+{
+  rtc.begin();
+  DS3231_sim.resetCounters();
+
+  printf("%-38s %6s %6s %6s %6s %8s\n", "call", "START", "STOP", "bytes", "SCL", "bus us");
+
+  rtc.setDateTime(0, 0, 12, 1, 1, 2020);
+  report("setDateTime(sec..year)");
+
+  rtc.getTime();
+  report("getTime()");
+
+  rtc.getUnixTime();
+  report("getUnixTime()");
+
+  rtc.getDOWStr();
+  rtc.getDateStr();
+  rtc.getTimeStr();
+  report("getDOWStr+getDateStr+getTimeStr");
+
+  Time t = rtc.getTime();
+  rtc.getDOWStr(t);
+  rtc.getDateStr(t);
+  rtc.getTimeStr(t);
+  report("getTime+getDOWStr/DateStr/TimeStr(t)");
+
+  rtc.getTemperature();
+  report("getTemperature()");
+
+  rtc.getTemperature();
+  rtc.getTemperatureQuarters();
+  report("getTemperature(), within 64 s");
+
+  rtc.startTemperatureConversion();
+  report("startTemperatureConversion()");
+
+  rtc.temperatureReady();
+  report("temperatureReady()");
+
+  while (!rtc.temperatureReady())
+    DS3231_sim.advance(10000UL);
+  DS3231_sim.resetCounters();
+  rtc.readTemperature();
+  report("readTemperature()");
+
+  // A status poll: the whole register file decoded from one burst
+  DS3231State state;
+  rtc.readAll(state);
+  report("readAll(state)");
+
+  rtc.setAlarm(ALM1_MATCH_MINUTES, 30, 0, 12, 1);
+  report("setAlarm(ALM1_MATCH_MINUTES)");
+
+  rtc.setOutput(ALARM1);
+  report("setOutput(ALARM1)");
+
+  rtc.setSQWRate(SQWAVE_1_HZ);
+  report("setSQWRate(SQWAVE_1_HZ)");
+
+  rtc.enable32KHz(false);
+  report("enable32KHz(false)");
+
+  rtc.checkAlarm();
+  report("checkAlarm()");
+
+  // Arming the next wake-up by hand, as a sleep loop would, and in one pass
+  t = rtc.getTime();
+  rtc.checkAlarm();
+  rtc.setAlarm(ALM1_MATCH_MINUTES, t.sec, (t.min + 1) % 60, 0, 0);
+  rtc.setOutput(ALARM1);
+  report("getTime+checkAlarm+setAlarm+setOutput");
+
+  rtc.setAlarmIn(60);
+  report("setAlarmIn(60)");
+  rtc.setAlarm(ALM1_MATCH_MINUTES, 30, 0, 12, 1);
+  DS3231_sim.resetCounters();
+
+  // The same configuration changes with the register cache enabled
+  rtc.enableRegisterCache(true);
+  rtc.refreshRegisterCache();
+  report("refreshRegisterCache()");
+
+  rtc.setOutput(ALARM1);
+  report("setOutput(ALARM1), cached");
+
+  rtc.setSQWRate(SQWAVE_1_HZ);
+  report("setSQWRate(SQWAVE_1_HZ), cached");
+
+  rtc.enable32KHz(false);
+  report("enable32KHz(false), cached");
+
+  rtc.checkAlarm();
+  report("checkAlarm(), cached");
+
+  rtc.setAlarmIn(60);
+  report("setAlarmIn(60), cached");
+  rtc.setAlarm(ALM1_MATCH_MINUTES, 30, 0, 12, 1);
+  DS3231_sim.resetCounters();
+
+  // Let the simulated oscillator run into the alarm
+  DS3231_sim.advance(31000000UL);
+  printf("\nalarm after 31 s: %u (time %s)\n", rtc.checkAlarm(), rtc.getTimeStr());
+
+  // A relative alarm across the end of the year
+  rtc.setDateTime(50, 59, 23, 31, 12, 2020);
+  rtc.setAlarmIn(30);
+  DS3231_sim.advance(29000000UL);
+  printf("setAlarmIn(30) at 31.12.2020 23:59:50: alarm after 29 s: %u, ", rtc.checkAlarm());
+  DS3231_sim.advance(1000000UL);
+  printf("after 30 s: %u (%s %s)\n", rtc.checkAlarm(), rtc.getDateStr(), rtc.getTimeStr());
+
+  rtc.readAll(state);
+  printf("readAll: %s %s, alarm 1 type 0x%02X %02u:%02u:%02u date %u, control 0x%02X, status 0x%02X, %.2f C\n\n",
+    rtc.getDateStr(state.time), rtc.getTimeStr(state.time), state.alarm1.type, state.alarm1.hour,
+    state.alarm1.min, state.alarm1.sec, state.alarm1.daydate, state.control, state.status, state.temperature);
+
+  // A forced conversion, polled every 10 ms without blocking
+  int polls = 0;
+  DS3231_sim.temperature = -23;   // -5.75 C
+  printf("cached %.2f C, ", rtc.getTemperature());
+  bool started = rtc.startTemperatureConversion();
+  printf("conversion %s, ", started ? "started" : "refused");
+  printf("second start %s, ", rtc.startTemperatureConversion() ? "started" : "refused");
+  while (!rtc.temperatureReady())
+  {
+    DS3231_sim.advance(10000UL);
+    polls++;
+  }
+  printf("ready after %d polls: %.2f C\n\n", polls, rtc.readTemperature());
+
+  // With the soft clock the RTC is read once and then advanced by the SQW edges
+  DS3231_sim.sqw = onSQW;
+  DS3231_sim.resetCounters();
+  rtc.enableSoftClock(true);
+  report("enableSoftClock(true)");
+
+  rtc.getTime();
+  rtc.getUnixTime();
+  report("getTime()+getUnixTime(), soft clock");
+
+  // Run past midnight without a resync and compare with the chip
+  rtc.enableSoftClock(true, 65535);
+  for (int i=0; i<50; i++)
+    DS3231_sim.advance(1000000000UL);
+  printf("after 50000 s: soft clock %s %s, ", rtc.getDateStr(), rtc.getTimeStr());
+  rtc.enableSoftClock(false);
+  printf("RTC %s %s\n", rtc.getDateStr(), rtc.getTimeStr());
+
+  // A missing RTC is reported instead of hanging the caller
+  DS3231_sim.present = false;
+  bool ok = rtc.getTime(t);
+  printf("RTC removed: getTime(t) %s, bus status %u\n", ok ? "ok" : "failed", rtc.getBusStatus());
+
+  return 0;
+}
@@ -0,0 +1,90 @@
+// DS3231_Host_Calibration
+//
+// A host-side (Linux/desktop) program that lets DS3231_Calibration learn the
+// frequency error of the simulated DS3231 in hardware/host. The simulated
+// crystal runs 3 ppm fast at 25 C and 0.06 ppm faster per degree, and the
+// room cycles through 15, 25, 35 and 25 C every day. The simulation time
+// stands in for the reference clock, e.g. NTP, that the program reports at
+// the start and end of each 6 hour block.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_Calibration.cpp -o calibration
+//   ./calibration
+//
+
+#include <stdio.h>
+#include <DS3231.h>
+
+DS3231              rtc(SDA, SCL);
+DS3231_Calibration  calibration(rtc);
+
+static int64_t      refOffset;     // Reference time less the simulation time in ms
+
+// The simulated INT/SQW pin interrupt
+static void onSQW()
+{
+  rtc.tick();
+}
+
+static uint64_t reference()
+{
+  return refOffset + DS3231_sim.elapsedMs();
+}
+
+// Time of the RTC less the reference time in ms
+static long error()
+{
+  return (long)((int64_t)rtc.getUnixTimeMs() - (int64_t)reference());
+}
+
+// Runs a number of days, calibrating if asked, and returns the RTC error
+// gathered over them
+static long run(int days, bool calibrate)
+{
+  static const int8_t temperatures[] = { 15, 25, 35, 25 };
+  long start = error();
+
+  for (int i=0; i<days*4; i++)
+  {
+    int8_t t = temperatures[i % 4];
+
+    DS3231_sim.temperature = t * 4;
+    DS3231_sim.rtcPpb = 3000 + 60 * (t - 25);
+    DS3231_sim.advance(65000000UL);           // Let the next conversion see the new temperature
+    if (calibrate)
+    {
+      calibration.restart();
+      calibration.update(reference());
+    }
+    for (int j=0; j<6*60; j++)
+      DS3231_sim.advance(60000000UL);
+    if (calibrate)
+      calibration.update(reference());
+  }
+  return error() - start;
+}
+
+int main()
+{
+  DS3231_sim.sqw = onSQW;
+  rtc.begin();
+  rtc.setDateTime(0, 0, 12, 1, 1, 2020);
+  rtc.enableSoftClock(true);
+  DS3231_sim.advance(2000000UL);              // First SQW edges, the soft clock has milliseconds now
+  refOffset = (int64_t)rtc.getUnixTimeMs() - (int64_t)DS3231_sim.elapsedMs();
+
+  printf("days  1-14, no calibration:   %6ld ms\n", run(14, false));
+  printf("days 15-28, learning:         %6ld ms\n", run(14, true));
+  printf("days 29-42, calibrated:       %6ld ms\n", run(14, true));
+  printf("aging offset now:             %6d\n", rtc.getAgingOffset());
+  printf("\n bin   temperature   error/ppm   observed/h\n");
+  for (uint8_t b=0; b<CALIBRATION_BINS; b++)
+    if (calibration.getBinSeconds(b) > 0)
+      printf("%4d   %4d..%3d C   %9.2f   %10lu\n", b,
+        CALIBRATION_BIN_MIN + b * CALIBRATION_BIN_WIDTH,
+        CALIBRATION_BIN_MIN + (b + 1) * CALIBRATION_BIN_WIDTH,
+        calibration.getBinError(b) / 100.0,
+        calibration.getBinSeconds(b) / 3600);
+  return 0;
+}
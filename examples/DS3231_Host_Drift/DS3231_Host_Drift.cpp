@@ -0,0 +1,112 @@
+// DS3231_Host_Drift
+//
+// A host-side (Linux/desktop) program that fits the drift of the simulated
+// DS3231 in hardware/host with DS3231_Drift. The simulated crystal runs
+// 2.5 ppm fast. Once an hour for two days the RTC is compared with a
+// reference clock that has up to 20 ms of jitter, like NTP over a radio
+// link. The fit then tells how long the corrected time holds a 100 ms error
+// budget, and the program checks that against the simulation. The reported
+// run is a typical one. The holdover is a 95% bound, so now and then a run
+// ends outside the budget; 100 more runs show the rate.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_Drift.cpp -o drift
+//   ./drift
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <DS3231.h>
+
+DS3231        rtc(SDA, SCL);
+DS3231_Drift  drift(rtc);
+
+static int64_t  refOffset;      // Reference time less the simulation time in ms
+
+// The simulated INT/SQW pin interrupt
+static void onSQW()
+{
+  rtc.tick();
+}
+
+// The true time in ms
+static uint64_t reference()
+{
+  return refOffset + DS3231_sim.elapsedMs();
+}
+
+// The reference as the program receives it
+static uint64_t jitteryReference()
+{
+  return reference() + rand() % 41 - 20;
+}
+
+static void advanceSeconds(unsigned long seconds)
+{
+  while (seconds > 60)
+  {
+    DS3231_sim.advance(60000000UL);
+    seconds -= 60;
+  }
+  DS3231_sim.advance(seconds * 1000000UL);
+}
+
+// Two days of hourly samples, then the holdover for a 100 ms budget.
+// Returns the corrected error at the end of the holdover in ms.
+static long trial(bool report)
+{
+  unsigned long hold;
+  long error;
+
+  rtc.setDateTime(0, 0, 12, 1, 1, 2020);
+  drift.restart();
+  DS3231_sim.advance(2000000UL);              // First SQW edges, the soft clock has milliseconds now
+
+  // The RTC was set some time ago and is 700 ms behind
+  refOffset = (int64_t)rtc.getUnixTimeMs() - (int64_t)DS3231_sim.elapsedMs() + 700;
+
+  for (int i=0; i<=48; i++)
+  {
+    drift.sample(jitteryReference());
+    if (i < 48)
+      advanceSeconds(3600);
+  }
+  hold = drift.holdover(100);
+  advanceSeconds(hold);
+  error = (long)((int64_t)drift.correctedUnixTimeMs() - (int64_t)reference());
+
+  if (report)
+  {
+    printf("samples:                      %6u\n", drift.samples());
+    printf("true drift:                   %6.3f ppm\n", DS3231_sim.rtcPpb / 1000.0);
+    printf("fitted drift:                 %6.3f +- %.3f ppm\n", drift.getDrift(), drift.getDriftError());
+    printf("residual:                     %6.1f ms\n", drift.getResidual());
+    printf("holdover for 100 ms:          %6lu s (%.1f days)\n", hold, hold / 86400.0);
+    printf("worst case at 2 ppm accuracy: %6lu s, not counting the offset\n", 100000UL / 2);
+    printf("after the holdover:\n");
+    printf("  uncorrected error:          %6ld ms\n", (long)((int64_t)rtc.getUnixTimeMs() - (int64_t)reference()));
+    printf("  corrected error:            %6ld ms\n", error);
+  }
+  return error;
+}
+
+int main()
+{
+  int within = 0;
+
+  DS3231_sim.rtcPpb = 2500;
+  DS3231_sim.sqw = onSQW;
+  rtc.begin();
+  rtc.enableSoftClock(true);
+
+  srand(7);
+  trial(true);
+
+  // The holdover is a 95% bound, check it over more runs
+  for (int i=0; i<100; i++)
+    if (labs(trial(false)) <= 100)
+      within++;
+  printf("\nwithin 100 ms after the holdover: %d of 100 runs\n", within);
+  return 0;
+}
@@ -0,0 +1,91 @@
+// DS3231_Host_Format
+//
+// A host-side (Linux/desktop) program that checks the formatting into caller
+// buffers. formatTime(), formatDate() and formatISO8601() are compared with
+// snprintf() for every valid field value. They take any Time the caller
+// hands them, so the fields are then run up to 255, where each one must
+// give its last two digits and the strings must stay inside their buffers.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_Format.cpp -o format
+//   ./format
+//
+// Adding -fsanitize=address also catches reads outside the digit table.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <DS3231.h>
+
+#define GUARD   0x5A            // Fills the buffers, the bytes after the string must keep it
+
+static char buffer[ISO8601_STR_LEN + 8];
+static unsigned long checks, errors;
+
+static void check(const char *expected, size_t len, size_t size)
+{
+  checks++;
+  if ((strcmp(buffer, expected) != 0) || (len != strlen(expected)) || (len >= size))
+  {
+    errors++;
+    if (errors <= 10)
+      printf("  got \"%s\", expected \"%s\"\n", buffer, expected);
+    return;
+  }
+  for (size_t i=len+1; i<sizeof(buffer); i++)
+    if (buffer[i] != GUARD)
+    {
+      errors++;
+      return;
+    }
+}
+
+// Each field from 0 to max, the others at a valid value
+static void run(int max)
+{
+  char    expected[64];
+  Time    t;
+  size_t  len;
+
+  for (int v=0; v<=max; v++)
+  {
+    t.year = 2020; t.mon = 6; t.date = 15;
+    t.hour = t.min = t.sec = v;
+    memset(buffer, GUARD, sizeof(buffer));
+    len = DS3231::formatTime(t, buffer);
+    snprintf(expected, sizeof(expected), "%02d:%02d:%02d", v % 100, v % 100, v % 100);
+    check(expected, len, TIME_STR_LEN);
+
+    t.hour = 12; t.min = 30; t.sec = 45;
+    t.date = t.mon = v;
+    memset(buffer, GUARD, sizeof(buffer));
+    len = DS3231::formatDate(t, buffer);
+    snprintf(expected, sizeof(expected), "%02d.%02d.2020", v % 100, v % 100);
+    check(expected, len, DATE_STR_LEN);
+
+    t.year = 1970 + v;
+    memset(buffer, GUARD, sizeof(buffer));
+    len = DS3231::formatDate(t, buffer, FORMAT_SHORT, FORMAT_BIGENDIAN, '-');
+    snprintf(expected, sizeof(expected), "%02d-%02d-%02d", v % 100, v % 100, v % 100);
+    check(expected, len, DATE_STR_LEN);
+
+    t.year = 2020;
+    t.hour = t.min = t.sec = v;
+    memset(buffer, GUARD, sizeof(buffer));
+    len = DS3231::formatISO8601(t, buffer, 999, -(v * 60 + 59));
+    snprintf(expected, sizeof(expected), "2020-%02d-%02dT%02d:%02d:%02d.999-%02d:59",
+      v % 100, v % 100, v % 100, v % 100, v % 100, v % 100);
+    check(expected, len, ISO8601_STR_LEN);
+  }
+}
+
+int main()
+{
+  run(99);
+  printf("valid fields:        %lu checks, %lu errors\n", checks, errors);
+  checks = errors = 0;
+  run(255);
+  printf("fields up to 255:    %lu checks, %lu errors\n", checks, errors);
+  return 0;
+}
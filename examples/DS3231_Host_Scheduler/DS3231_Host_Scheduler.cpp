@@ -0,0 +1,114 @@
+// DS3231_Host_Scheduler
+//
+// A host-side (Linux/desktop) program that runs DS3231_Scheduler against the
+// simulated DS3231 in hardware/host for 40 simulated days. The MCU "sleeps"
+// until the simulated INT pin goes low, so it only wakes up when Alarm 1
+// fires. Every callback checks that it runs in the second it was due.
+// A second scheduler is then polled with the soft clock, and one failed bus
+// call must not hold back its next event.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_Scheduler.cpp -o scheduler
+//   ./scheduler
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <DS3231.h>
+
+DS3231            rtc(SDA, SCL);
+DS3231_Scheduler  scheduler(rtc);
+DS3231_Scheduler  polled(rtc);
+
+unsigned long expected[SCHEDULER_SIZE];
+unsigned long period[SCHEDULER_SIZE];
+unsigned long runs, late, polledRuns;
+
+// The simulated INT/SQW pin interrupt
+static void onSQW()
+{
+  rtc.tick();
+}
+
+static void onPolled(uint8_t)
+{
+  polledRuns++;
+}
+
+static void onEvent(uint8_t id)
+{
+  if (rtc.getUnixTime() != expected[id])
+    late++;
+  expected[id] += period[id];
+  runs++;
+}
+
+static void add(unsigned long at, unsigned long every)
+{
+  int8_t id = scheduler.scheduleAt(at, onEvent, every);
+
+  if (id >= 0)
+  {
+    expected[id] = at;
+    period[id] = every;
+  }
+}
+
+int main()
+{
+  unsigned long start, wakeups = 0;
+  int8_t cancelled;
+
+  rtc.begin();
+  rtc.setDateTime(0, 0, 12, 15, 1, 2020);
+  scheduler.begin();
+  start = rtc.getUnixTime();
+
+  add(start + 7, 7);              // Every 7 seconds
+  add(start + 90, 90);            // Every minute and a half
+  add(start + 3600, 3600);        // Hourly
+  add(start + 86400, 86400);      // Daily
+  srand(1);
+  for (int i=0; i<8; i++)         // One-shots up to 40 days ahead
+    add(start + 1 + rand() % (40UL * 86400), 0);
+  cancelled = scheduler.scheduleIn(1000, onEvent);
+  scheduler.cancel(cancelled);
+
+  // Sleep until INT goes low (A1F set), waking on each seconds update the
+  // way the INT edge would
+  for (unsigned long s=0; s<40UL * 86400; s++)
+  {
+    DS3231_sim.advance(1000000UL - DS3231_sim.fractionUs());
+    if (DS3231_sim.regs[0x0F] & 0x01)
+    {
+      wakeups++;
+      scheduler.checkAlarm();
+    }
+  }
+
+  printf("seconds simulated:   %lu\n", 40UL * 86400);
+  printf("wake-ups:            %lu\n", wakeups);
+  printf("callbacks run:       %lu\n", runs);
+  printf("callbacks off time:  %lu\n", late);
+  printf("events pending:      %u\n", scheduler.pending());
+
+  // The soft clock serves the time without the bus. An unrelated bus error
+  // just before must not keep the event from running when it is due.
+  unsigned long waited = 0;
+
+  DS3231_sim.sqw = onSQW;
+  rtc.enableSoftClock(true);
+  polled.scheduleIn(10, onPolled);
+  DS3231_sim.present = false;
+  rtc.getAgingOffset();
+  DS3231_sim.present = true;
+  while ((!polledRuns) && (waited < 60))
+  {
+    DS3231_sim.advance(1000000UL);
+    waited++;
+    polled.checkAlarm();
+  }
+  printf("after a bus error:   %s after %lu s\n", polledRuns ? "event ran" : "event missing", waited);
+  return 0;
+}
@@ -0,0 +1,78 @@
+// DS3231_Host_SubSecond
+//
+// A host-side (Linux/desktop) program that checks the sub-second timestamps
+// of getTimeMicros() against the simulated DS3231 in hardware/host. The
+// simulated MCU clock (micros()) runs 3000 ppm fast, like a ceramic
+// resonator. The library measures that drift on the 1 Hz SQW edges and
+// corrects the interpolation once the first measurement is done.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -DDS3231_HOST -I../.. ../../DS3231.cpp DS3231_Host_SubSecond.cpp -o subsecond
+//   ./subsecond
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <DS3231.h>
+
+DS3231  rtc(SDA, SCL);
+
+// The simulated INT/SQW pin interrupt
+static void onSQW()
+{
+  rtc.tick();
+}
+
+// Error of getTimeMicros() against the simulated chip in microseconds
+static long sampleError()
+{
+  Time t;
+  uint32_t usec = rtc.getTimeMicros(t);
+  long chip = (long)((DS3231_sim.regs[0] >> 4) * 10 + (DS3231_sim.regs[0] & 15)) * 1000000L + DS3231_sim.fractionUs();
+  long soft = (long)t.sec * 1000000L + usec;
+  long error = soft - chip;
+
+  // Samples right at the minute wrap
+  if (error > 30000000L)
+    error -= 60000000L;
+  else if (error < -30000000L)
+    error += 60000000L;
+  return error;
+}
+
+int main()
+{
+  long maxBefore = 0, maxAfter = 0, error;
+
+  DS3231_sim.mcuPpm = 3000;
+  DS3231_sim.sqw = onSQW;
+  rtc.begin();
+  rtc.setDateTime(0, 0, 12, 1, 1, 2020);
+  rtc.enableSoftClock(true);
+
+  // Sample at uneven points in time for ten minutes. The first drift
+  // measurement is done after 64 SQW edges.
+  srand(1);
+  for (int i=0; i<6000; i++)
+  {
+    DS3231_sim.advance(50000 + rand() % 100000);
+    error = labs(sampleError());
+    if (DS3231_sim.elapsedUs() < 2000000UL)
+      continue;                 // No SQW edge seen yet, the microseconds are 0
+    if (DS3231_sim.elapsedUs() < 65000000UL)
+    {
+      if (error > maxBefore)
+        maxBefore = error;
+    }
+    else if (error > maxAfter)
+      maxAfter = error;
+  }
+
+  printf("MCU clock error:          %6ld ppm\n", (long)DS3231_sim.mcuPpm);
+  printf("measured drift:           %6d ppm\n", rtc.getMCUDrift());
+  printf("max error, uncorrected:   %6ld us\n", maxBefore);
+  printf("max error, corrected:     %6ld us\n", maxAfter);
+  printf("getUnixTimeMs():          %llu\n", (unsigned long long)rtc.getUnixTimeMs());
+  return 0;
+}
@@ -0,0 +1,194 @@
+// DS3231_Linux_StubDevice
+//
+// A test harness for the Linux i2c-dev backend (hardware/linux) that runs
+// without an RTC or an I2C adapter. The linker redirects the open(), ioctl()
+// and close() calls of the library to a stub /dev/i2c-N that holds a DS3231
+// register file, so the library code runs unchanged down to the system
+// call. The harness counts the system calls per library call, measures the
+// time spent in the library per getTime(), checks the error reporting and
+// that the device is closed again.
+//
+// This is not an Arduino sketch. Build and run it from this folder with:
+//
+//   g++ -O2 -DDS3231_LINUX -I../.. ../../DS3231.cpp DS3231_Linux_StubDevice.cpp -Wl,--wrap=open,--wrap=ioctl,--wrap=close -o stubdevice
+//   ./stubdevice
+//
+// Built without the --wrap options (and without this file) the same library
+// code talks to a real DS3231 on /dev/i2c-1.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <DS3231.h>
+
+#define STUB_FD		1000		// File descriptor of the stub device
+#define STUB_REGS	0x13		// Register file 0x00-0x12
+
+extern "C" int __real_open(const char *path, int flags, ...);
+extern "C" int __real_ioctl(int fd, unsigned long request, ...);
+extern "C" int __real_close(int fd);
+
+// The stub device
+uint8_t       regs[STUB_REGS];
+uint8_t       ptr;              // Register pointer
+bool          present = true;   // False: nothing acknowledges the address
+unsigned long opens, closes, ioctls, transfers, messages;
+
+extern "C" int __wrap_open(const char *path, int flags, ...)
+{
+  mode_t mode = 0;
+  va_list args;
+
+  va_start(args, flags);
+  if (flags & O_CREAT)
+    mode = va_arg(args, int);
+  va_end(args);
+
+  if (strncmp(path, "/dev/i2c-", 9) != 0)
+    return __real_open(path, flags, mode);
+  opens++;
+  if (strcmp(path, "/dev/i2c-1") != 0)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  return STUB_FD;
+}
+
+// I2C_RDWR: a write message sets the register pointer and writes the
+// registers after it, a read message reads from the pointer on. The
+// pointer wraps around at the end of the register file like in the chip.
+extern "C" int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+  struct i2c_rdwr_ioctl_data *data;
+  va_list args;
+  void *arg;
+
+  va_start(args, request);
+  arg = va_arg(args, void *);
+  va_end(args);
+  if (fd != STUB_FD)
+    return __real_ioctl(fd, request, arg);
+
+  ioctls++;
+  if (request == I2C_TIMEOUT)
+    return 0;
+  if (request != I2C_RDWR)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  data = (struct i2c_rdwr_ioctl_data *)arg;
+  transfers++;
+  for (unsigned i=0; i<data->nmsgs; i++)
+  {
+    struct i2c_msg *msg = &data->msgs[i];
+
+    messages++;
+    if ((!present) || (msg->addr != DS3231_ADDR))
+    {
+      errno = ENXIO;
+      return -1;
+    }
+    for (unsigned j=0; j<msg->len; j++)
+    {
+      if (msg->flags & I2C_M_RD)
+        msg->buf[j] = regs[ptr];
+      else if (j == 0)
+      {
+        ptr = msg->buf[0] % STUB_REGS;
+        continue;
+      }
+      else
+        regs[ptr] = msg->buf[j];
+      ptr = (ptr + 1) % STUB_REGS;
+    }
+  }
+  return data->nmsgs;
+}
+
+extern "C" int __wrap_close(int fd)
+{
+  if (fd != STUB_FD)
+    return __real_close(fd);
+  closes++;
+  return 0;
+}
+
+static double nowNs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void count(const char *name)
+{
+  printf("%-32s %6lu %9lu %8lu\n", name, ioctls, transfers, messages);
+  ioctls = transfers = messages = 0;
+}
+
+int main()
+{
+  DS3231 rtc(SDA, SCL);
+  const long loops = 1000000;
+  double start, ns;
+  Time t;
+  bool ok;
+
+  rtc.begin();
+  printf("%-32s %6s %9s %8s\n", "call", "ioctl", "I2C_RDWR", "messages");
+  count("begin()");
+
+  rtc.setDateTime(56, 34, 12, 15, 6, 2021);
+  count("setDateTime(sec..year)");
+
+  t = rtc.getTime();
+  count("getTime()");
+
+  rtc.getTemperature();
+  count("getTemperature()");
+
+  rtc.setAlarmIn(60);
+  count("setAlarmIn(60)");
+
+  rtc.checkAlarm();
+  count("checkAlarm()");
+
+  printf("\ntime read back: %s %s, %s\n", rtc.getDateStr(), rtc.getTimeStr(), rtc.getDOWStr());
+  ioctls = transfers = messages = 0;
+
+  // Time in the library per getTime(), the stub device itself is trivial
+  start = nowNs();
+  for (long i=0; i<loops; i++)
+    rtc.getTime(t);
+  ns = (nowNs() - start) / loops;
+  printf("getTime() x %ld: %lu ioctl calls, %.0f ns per call\n", loops, ioctls, ns);
+
+  // Errors of the driver are reported through getBusStatus()
+  present = false;
+  ok = rtc.getTime(t);
+  printf("RTC not answering: getTime(t) %s, bus status %u\n", ok ? "ok" : "failed", rtc.getBusStatus());
+  present = true;
+
+  DS3231 missing(0, SCL);
+  missing.begin();
+  ok = missing.getTime(t);
+  printf("no /dev/i2c-0: getTime(t) %s, bus status %u\n", ok ? "ok" : "failed", missing.getBusStatus());
+
+  // The destructor closes the device
+  opens = closes = 0;
+  {
+    DS3231 scoped(SDA, SCL);
+    scoped.begin();
+  }
+  printf("DS3231 out of scope: %lu open, %lu close\n", opens, closes);
+  return 0;
+}
@@ -61,16 +61,19 @@ void setup()
 
 void loop()
 {
+  // Read the clock once, so all fields come from the same second
+  Time t = rtc.getTime();
+
   // Send Day-of-Week
-  Serial.print(rtc.getDOWStr());
+  Serial.print(rtc.getDOWStr(t));
   Serial.print(" ");
   
   // Send date
-  Serial.print(rtc.getDateStr());
+  Serial.print(rtc.getDateStr(t));
   Serial.print(" -- ");
 
   // Send time
-  Serial.println(rtc.getTimeStr());
+  Serial.println(rtc.getTimeStr(t));
   
   // Wait one second before repeating :)
   delay (1000);
@@ -71,7 +71,7 @@ void loop()
   Serial.print("Today is the ");
   Serial.print(t.date, DEC);
   Serial.print(". day of ");
-  Serial.print(rtc.getMonthStr());
+  Serial.print(rtc.getMonthStr(t));
   Serial.print(" in the year ");
   Serial.print(t.year, DEC);
   Serial.println(".");
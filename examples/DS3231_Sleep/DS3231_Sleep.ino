@@ -48,7 +48,7 @@ DS3231 RTC(SDA, SCL);
 volatile unsigned long milsecElapsed = 0L; // Mimics millisecond counter
 
 unsigned long tmMillis[2], tmTimer1[2];
-String tmRTC[2];
+char tmRTC[2][TIME_STR_LEN];
 
 void setup()
 {
@@ -74,33 +74,9 @@ void setup()
 
 void loop()
 {
-  // Prepare for sleep
-  Time curTime = RTC.getTime();
-  curTime.sec += 30;
-  if (curTime.sec > 59)
-  {
-    curTime.min += 1;
-    curTime.sec = (curTime.sec % 60);
-  }
-  //curTime.min += 30;
-  if (curTime.min > 59)
-  {
-    curTime.hour += 1;
-    curTime.min = (curTime.min % 60);
-  }
-  //curTime.hour += 30;
-  if (curTime.hour > 24)
-  {
-    curTime.date += 1;
-    curTime.hour = (curTime.hour % 24);
-  }
-
-  //Serial.print(F("ALARM: "));
-  //Serial.print(curTime.hour); Serial.print(F(":")); Serial.print(curTime.min); Serial.print(F(":")); Serial.println(curTime.sec);
-
-  RTC.checkAlarm(); // Clear RTC Alarm flags
-  RTC.setAlarm(ALARM_TYPES_t::ALM1_MATCH_MINUTES, curTime.sec, curTime.min, curTime.hour, curTime.date);
-  RTC.setOutput(MODES_t::ALARM1);
+  // Prepare for sleep: Alarm 1 in 30 seconds, its flag cleared and its
+  // interrupt driving the INT/SQW pin, all in one call
+  RTC.setAlarmIn(30);
 
   //Serial.println(F("SLEEP")); 
   //Serial.print(F("\tMILLIS: ")); Serial.println(millis());
@@ -110,7 +86,7 @@ void loop()
 
   tmMillis[0] = millis();
   tmTimer1[0] = milsecElapsed;
-  tmRTC[0] = RTC.getTimeStr();
+  DS3231::formatTime(RTC.getTime(), tmRTC[0]);
 
   // MCU Put to sleep
   sleepNow();
@@ -130,15 +106,15 @@ void loop()
 
   tmMillis[1] = millis();
   tmTimer1[1] = milsecElapsed;
-  tmRTC[1] = RTC.getTimeStr();
+  DS3231::formatTime(RTC.getTime(), tmRTC[1]);
 
   Serial.println(F("Before Sleep"));
   Serial.print(F("\tMILLIS: ")); Serial.println(tmMillis[0]);
-  Serial.print(F("\tRTC CLK: ")); Serial.print(tmRTC[0] + "."); Serial.println(tmTimer1[0]);
+  Serial.print(F("\tRTC CLK: ")); Serial.print(tmRTC[0]); Serial.print(F(".")); Serial.println(tmTimer1[0]);
 
   Serial.println(F("After Sleep"));
   Serial.print(F("\tMILLIS: ")); Serial.println(tmMillis[1]);
-  Serial.print(F("\tRTC CLK: ")); Serial.print(tmRTC[1] + "."); Serial.println(tmTimer1[1]);
+  Serial.print(F("\tRTC CLK: ")); Serial.print(tmRTC[1]); Serial.print(F(".")); Serial.println(tmTimer1[1]);
 
   // Stuck here
   Serial.println(F("DONE")); Serial.flush();
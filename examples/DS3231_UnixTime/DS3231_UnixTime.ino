@@ -58,19 +58,20 @@ void setup()
 
 void loop()
 {
+  // Read the clock once and use the same snapshot for all outputs
+  Time now = rtc.getTime();
+
   // Send Current time
   Serial.print("Current Time.............................: ");
-  Serial.print(rtc.getDOWStr());
+  Serial.print(rtc.getDOWStr(now));
   Serial.print(" ");
-  Serial.print(rtc.getDateStr());
+  Serial.print(rtc.getDateStr(now));
   Serial.print(" -- ");
-  Serial.println(rtc.getTimeStr());
+  Serial.println(rtc.getTimeStr(now));
 
   // Send Unixtime
-  // ** Note that there may be a one second difference between the current time **
-  // ** and current unixtime show if the second changes between the two calls   **
   Serial.print("Current Unixtime.........................: ");
-  Serial.println(rtc.getUnixTime(rtc.getTime()));
+  Serial.println(rtc.getUnixTime(now));
   
   // Send Unixtime for 00:00:00 on January 1th 2014
   Serial.print("Unixtime for 00:00:00 on January 1th 2014: ");
@@ -0,0 +1,89 @@
+#!/bin/sh
+# Static RAM and flash footprint of the library per feature
+#
+# Compiles DS3231.cpp once for each set of feature defines in CONFIGS below
+# and prints the flash (text + data) and static RAM (data + bss) of the
+# object, the RAM of each DS3231 object, and what each set saves against
+# the default build. This is the
+# footprint of the whole library; the linker drops the functions a sketch
+# does not call, so a sketch usually pays less, and saves less with the
+# DS3231_NO_* switches. With -v the static RAM of the default build is also
+# listed per symbol.
+#
+# Run it from the library folder. For AVR, point ARDUINO_AVR at the AVR core
+# of an Arduino IDE installation:
+#
+#   ARDUINO_AVR=~/.arduino15/packages/arduino/hardware/avr/1.8.6 sh extras/footprint.sh
+#
+# MCU (atmega328p) and VARIANT (standard) select the board. TARGET=host
+# measures the host build instead and needs nothing but g++.
+
+CONFIGS="default|
+DS3231_ASYNC|-DDS3231_ASYNC
+DS3231_BUS_HW|-DDS3231_BUS_HW
+DS3231_BUS_SOFT|-DDS3231_BUS_SOFT -DDS3231_SDA_PIN=18 -DDS3231_SCL_PIN=19
+DS3231_NO_FORMAT|-DDS3231_NO_FORMAT
+DS3231_NO_ALARMS|-DDS3231_NO_ALARMS
+DS3231_NO_TEMPERATURE|-DDS3231_NO_TEMPERATURE
+DS3231_NO_DOW|-DDS3231_NO_DOW
+DS3231_BUS_HW + all DS3231_NO_*|-DDS3231_BUS_HW -DDS3231_NO_FORMAT -DDS3231_NO_ALARMS -DDS3231_NO_TEMPERATURE -DDS3231_NO_DOW"
+
+if [ "$TARGET" = "host" ]; then
+	CXX="${CXX:-g++}"
+	SIZE="${SIZE:-size}"
+	NM="${NM:-nm}"
+	FLAGS="-Os -DDS3231_HOST"
+else
+	if [ -z "$ARDUINO_AVR" ]; then
+		echo "Set ARDUINO_AVR to the AVR core folder, or TARGET=host" >&2
+		exit 1
+	fi
+	CXX="${CXX:-avr-g++}"
+	SIZE="${SIZE:-avr-size}"
+	NM="${NM:-avr-nm}"
+	FLAGS="-Os -mmcu=${MCU:-atmega328p} -DF_CPU=16000000L -DARDUINO=10819 -DARDUINO_ARCH_AVR
+		-I$ARDUINO_AVR/cores/arduino -I$ARDUINO_AVR/variants/${VARIANT:-standard}"
+fi
+FLAGS="$FLAGS -ffunction-sections -fdata-sections -I."
+
+OBJ="${TMPDIR:-/tmp}/ds3231_footprint.$$.o"
+PROBE="${TMPDIR:-/tmp}/ds3231_probe.$$"
+trap 'rm -f "$OBJ" "$PROBE.cpp" "$PROBE.o"' EXIT
+
+# sizeof(DS3231), read from the size of an object in a second file, so that
+# nothing needs to run on the target
+printf '#include "DS3231.h"\nDS3231 footprintProbe(0, 0);\n' > "$PROBE.cpp"
+
+hex() {
+	awk -v h="$1" 'BEGIN { n = 0; for (i = 1; i <= length(h); i++) n = n * 16 + index("0123456789abcdef", tolower(substr(h, i, 1))) - 1; print n }'
+}
+
+printf "%-32s %8s %8s %8s %8s %8s %8s\n" "configuration" "flash" "RAM" "object" "-flash" "-RAM" "-object"
+echo "$CONFIGS" | while IFS='|' read -r name defines; do
+	# shellcheck disable=SC2086
+	if ! $CXX $FLAGS $defines -c DS3231.cpp -o "$OBJ" 2>/dev/null; then
+		printf "%-32s %17s\n" "$name" "does not build"
+		continue
+	fi
+	# shellcheck disable=SC2086
+	$CXX $FLAGS $defines -c "$PROBE.cpp" -o "$PROBE.o" || exit 1
+	object=$(hex "$($NM -S "$PROBE.o" | awk '$4 == "footprintProbe" { print $2 }')")
+	# shellcheck disable=SC2046
+	set -- $($SIZE "$OBJ" | awk 'NR == 2 { print $1 + $2, $2 + $3 }')
+	if [ "$name" = "default" ]; then
+		flash0=$1
+		ram0=$2
+		object0=$object
+	fi
+	printf "%-32s %8d %8d %8d %8d %8d %8d\n" "$name" "$1" "$2" "$object" \
+		$((flash0 - $1)) $((ram0 - $2)) $((object0 - object))
+done
+
+if [ "$1" = "-v" ]; then
+	# shellcheck disable=SC2086
+	$CXX $FLAGS -c DS3231.cpp -o "$OBJ" || exit 1
+	printf "\nstatic RAM of the default build:\n"
+	$NM -C -S --size-sort "$OBJ" | awk '$3 ~ /^[bBdD]$/ { print $2, $0 }' | while read -r size _ _ _ symbol; do
+		printf "%8d  %s\n" "$(hex "$size")" "$symbol"
+	done
+fi
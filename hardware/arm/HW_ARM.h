@@ -1,34 +1,37 @@
+#if defined(DS3231_ASYNC)
+	static DS3231	*_twiOwner;
+#endif
+
 void DS3231::begin()
 {
-	_use_hw = false;
-	if ((_sda_pin == SDA) and (_scl_pin == SCL))
-	{
-		_use_hw = true;
-		twi = TWI1;
-		pmc_enable_periph_clk(WIRE_INTERFACE_ID);
-		PIO_Configure(g_APinDescription[PIN_WIRE_SDA].pPort, g_APinDescription[PIN_WIRE_SDA].ulPinType, g_APinDescription[PIN_WIRE_SDA].ulPin, g_APinDescription[PIN_WIRE_SDA].ulPinConfiguration);
-		PIO_Configure(g_APinDescription[PIN_WIRE_SCL].pPort, g_APinDescription[PIN_WIRE_SCL].ulPinType, g_APinDescription[PIN_WIRE_SCL].ulPin, g_APinDescription[PIN_WIRE_SCL].ulPinConfiguration);
-		NVIC_DisableIRQ(TWI1_IRQn);
-		NVIC_ClearPendingIRQ(TWI1_IRQn);
-		NVIC_SetPriority(TWI1_IRQn, 0);
-		NVIC_EnableIRQ(TWI1_IRQn);
-
-	}
-	else if ((_sda_pin == SDA1) and (_scl_pin == SCL1))
+#if !defined(DS3231_BUS_HW) && !defined(DS3231_BUS_SOFT)
+	_use_hw = ((_sda_pin == SDA) and (_scl_pin == SCL)) or ((_sda_pin == SDA1) and (_scl_pin == SCL1));
+#endif
+	if (DS3231_USE_HW)
 	{
-		_use_hw = true;
-		twi = TWI0;
-		pmc_enable_periph_clk(WIRE1_INTERFACE_ID);
-		PIO_Configure(g_APinDescription[PIN_WIRE1_SDA].pPort, g_APinDescription[PIN_WIRE1_SDA].ulPinType, g_APinDescription[PIN_WIRE1_SDA].ulPin, g_APinDescription[PIN_WIRE1_SDA].ulPinConfiguration);
-		PIO_Configure(g_APinDescription[PIN_WIRE1_SCL].pPort, g_APinDescription[PIN_WIRE1_SCL].ulPinType, g_APinDescription[PIN_WIRE1_SCL].ulPin, g_APinDescription[PIN_WIRE1_SCL].ulPinConfiguration);
-		NVIC_DisableIRQ(TWI0_IRQn);
-		NVIC_ClearPendingIRQ(TWI0_IRQn);
-		NVIC_SetPriority(TWI0_IRQn, 0);
-		NVIC_EnableIRQ(TWI0_IRQn);
-	}
+		if (DS3231_SDA == SDA1)
+		{
+			twi = TWI0;
+			pmc_enable_periph_clk(WIRE1_INTERFACE_ID);
+			PIO_Configure(g_APinDescription[PIN_WIRE1_SDA].pPort, g_APinDescription[PIN_WIRE1_SDA].ulPinType, g_APinDescription[PIN_WIRE1_SDA].ulPin, g_APinDescription[PIN_WIRE1_SDA].ulPinConfiguration);
+			PIO_Configure(g_APinDescription[PIN_WIRE1_SCL].pPort, g_APinDescription[PIN_WIRE1_SCL].ulPinType, g_APinDescription[PIN_WIRE1_SCL].ulPin, g_APinDescription[PIN_WIRE1_SCL].ulPinConfiguration);
+			NVIC_DisableIRQ(TWI0_IRQn);
+			NVIC_ClearPendingIRQ(TWI0_IRQn);
+			NVIC_SetPriority(TWI0_IRQn, 0);
+			NVIC_EnableIRQ(TWI0_IRQn);
+		}
+		else	// SDA/SCL, and any other pins with DS3231_BUS_HW
+		{
+			twi = TWI1;
+			pmc_enable_periph_clk(WIRE_INTERFACE_ID);
+			PIO_Configure(g_APinDescription[PIN_WIRE_SDA].pPort, g_APinDescription[PIN_WIRE_SDA].ulPinType, g_APinDescription[PIN_WIRE_SDA].ulPin, g_APinDescription[PIN_WIRE_SDA].ulPinConfiguration);
+			PIO_Configure(g_APinDescription[PIN_WIRE_SCL].pPort, g_APinDescription[PIN_WIRE_SCL].ulPinType, g_APinDescription[PIN_WIRE_SCL].ulPin, g_APinDescription[PIN_WIRE_SCL].ulPinConfiguration);
+			NVIC_DisableIRQ(TWI1_IRQn);
+			NVIC_ClearPendingIRQ(TWI1_IRQn);
+			NVIC_SetPriority(TWI1_IRQn, 0);
+			NVIC_EnableIRQ(TWI1_IRQn);
+		}
 
-	if (_use_hw)
-	{
 		// activate internal pullups for twi.
 		digitalWrite(SDA, 1);
 		digitalWrite(SCL, 1);
@@ -45,110 +48,172 @@ void DS3231::begin()
 	}
 	else
 	{
-		pinMode(_scl_pin, OUTPUT);
+		pinMode(DS3231_SCL, OUTPUT);
 	}
 }
 
-void DS3231::_burstRead()
+// Waits for a TWI status flag within the transaction budget. Fails early
+// on a NACK, the TWI has then already sent STOP.
+bool DS3231::_twiWait(uint32_t flag)
 {
-	if (_use_hw)
-	{
-		// Set slave address and number of internal address bytes.
-		twi->TWI_MMR = (1 << 8) | TWI_MMR_MREAD | (DS3231_ADDR << 16);
-		// Set internal address bytes
-		twi->TWI_IADR = 0;
-		// Send START condition
-		twi->TWI_CR = TWI_CR_START;
+	uint32_t status;
 
-		for (int i=0; i<6; i++)
+	for (;;)
+	{
+		status = twi->TWI_SR;
+		if (status & TWI_SR_NACK)
 		{
-			while ((twi->TWI_SR & TWI_SR_RXRDY) != TWI_SR_RXRDY)
-			{
-			};
-			_burstArray[i] = twi->TWI_RHR;
+			_status = BUS_NACK;
+			return false;
 		}
-
-		twi->TWI_CR = TWI_CR_STOP;
-		while ((twi->TWI_SR & TWI_SR_RXRDY) != TWI_SR_RXRDY) {};
-		_burstArray[6] = twi->TWI_RHR;
-		while ((twi->TWI_SR & TWI_SR_TXCOMP) != TWI_SR_TXCOMP) {};
-	}
-	else
-	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(0);
-		_waitForAck();
-		_sendStart(DS3231_ADDR_R);
-		_waitForAck();
-
-		for (int i=0; i<7; i++)
+		if (status & flag)
+			return true;
+		if (_busExpired())
 		{
-			_burstArray[i] = _readByte();
-			if (i<6)
-				_sendAck();
-			else
-				_sendNack();
+			_busReset();
+			return false;
 		}
-		_sendStop();
 	}
 }
 
-uint8_t DS3231::_readRegister(uint8_t reg)
+// Stops a hung transfer, including one of the background engine
+void DS3231::_busReset()
 {
-	uint8_t	readValue=0;
+	twi->TWI_PTCR = TWI_PTCR_RXTDIS;
+	twi->TWI_IDR = TWI_IDR_ENDRX | TWI_IDR_RXRDY | TWI_IDR_NACK;
+	twi->TWI_CR = TWI_CR_STOP;
+}
 
-	if (_use_hw)
+void DS3231::_burstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	if (DS3231_USE_HW)
 	{
+		_busBegin();
+		if (!_waitForAsync())
+			return;
 		// Set slave address and number of internal address bytes.
 		twi->TWI_MMR = (1 << 8) | TWI_MMR_MREAD | (DS3231_ADDR << 16);
 		// Set internal address bytes
 		twi->TWI_IADR = reg;
-		// Send START and STOP condition to read a single byte
-		twi->TWI_CR = TWI_CR_START | TWI_CR_STOP;
-		while ((twi->TWI_SR & TWI_SR_RXRDY) != TWI_SR_RXRDY) {};
-		readValue = twi->TWI_RHR;
-		while ((twi->TWI_SR & TWI_SR_TXCOMP) != TWI_SR_TXCOMP) {};
+		// Send START condition, together with STOP for a single byte
+		if (count == 1)
+			twi->TWI_CR = TWI_CR_START | TWI_CR_STOP;
+		else
+			twi->TWI_CR = TWI_CR_START;
+
+		for (int i=0; i<count-1; i++)
+		{
+			if (!_twiWait(TWI_SR_RXRDY))
+				return;
+			buffer[i] = twi->TWI_RHR;
+		}
+
+		if (count > 1)
+			twi->TWI_CR = TWI_CR_STOP;
+		if (!_twiWait(TWI_SR_RXRDY))
+			return;
+		buffer[count-1] = twi->TWI_RHR;
+		_twiWait(TWI_SR_TXCOMP);
 	}
 	else
-	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(reg);
-		_waitForAck();
-		_sendStart(DS3231_ADDR_R);
-		_waitForAck();
-		readValue = _readByte();
-		_sendNack();
-		_sendStop();
-	}
-	return readValue;
+		_softBurstRead(reg, buffer, count);
 }
 
-void DS3231::_writeRegister(uint8_t reg, uint8_t value)
+void DS3231::_burstWrite(uint8_t reg, uint8_t *values, uint8_t count)
 {
-	if (_use_hw)
+	if (DS3231_USE_HW)
 	{
+		_busBegin();
+		if (!_waitForAsync())
+			return;
 		// Set slave address and number of internal address bytes.
 		twi->TWI_MMR = (1 << 8) | (DS3231_ADDR << 16);
 		// Set internal address bytes
 		twi->TWI_IADR = reg;
-		// Send a single byte to start transfer
-		twi->TWI_THR = value;
-		while ((twi->TWI_SR & TWI_SR_TXRDY) != TWI_SR_TXRDY) {};
+		// Writing the first byte starts the transfer, the register pointer auto-increments
+		for (int i=0; i<count; i++)
+		{
+			twi->TWI_THR = values[i];
+			if (!_twiWait(TWI_SR_TXRDY))
+				return;
+		}
 		// Send STOP condition
 		twi->TWI_CR = TWI_CR_STOP;
-		while ((twi->TWI_SR & TWI_SR_TXCOMP) != TWI_SR_TXCOMP) {};
+		_twiWait(TWI_SR_TXCOMP);
 	}
 	else
+		_softBurstWrite(reg, values, count);
+}
+
+#if defined(DS3231_ASYNC)
+// Let the PDC move all but the last byte of the block into the buffer. The
+// last byte has to be received after STOP was requested, which is done from
+// the ENDRX interrupt.
+bool DS3231::_startBurstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	if ((!DS3231_USE_HW) || (count < 2))
+		return false;
+	_twiOwner = this;
+	_twiBuffer = buffer;
+	_twiCount = count;
+	// Set slave address and number of internal address bytes.
+	twi->TWI_MMR = (1 << 8) | TWI_MMR_MREAD | (DS3231_ADDR << 16);
+	// Set internal address bytes
+	twi->TWI_IADR = reg;
+	// Set up the receive PDC channel
+	twi->TWI_RPR = (uint32_t)buffer;
+	twi->TWI_RCR = count - 1;
+	twi->TWI_PTCR = TWI_PTCR_RXTEN;
+	// Send START condition, continue in the interrupt
+	twi->TWI_CR = TWI_CR_START;
+	twi->TWI_IER = TWI_IER_ENDRX | TWI_IER_NACK;
+	return true;
+}
+
+void DS3231::_twiISR()
+{
+	uint32_t status = twi->TWI_SR & twi->TWI_IMR;
+
+	if (status & TWI_SR_NACK)
 	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(reg);
-		_waitForAck();
-		_writeByte(value);
-		_waitForAck();
-		_sendStop();
+		// No answer from the RTC, the TWI has already sent STOP
+		twi->TWI_PTCR = TWI_PTCR_RXTDIS;
+		twi->TWI_IDR = TWI_IDR_ENDRX | TWI_IDR_RXRDY | TWI_IDR_NACK;
+		_status = BUS_NACK;
+		_burstDone(false);
 	}
+	else if (status & TWI_SR_ENDRX)
+	{
+		// The PDC is done and the last byte is being received
+		twi->TWI_PTCR = TWI_PTCR_RXTDIS;
+		twi->TWI_IDR = TWI_IDR_ENDRX;
+		twi->TWI_CR = TWI_CR_STOP;
+		twi->TWI_IER = TWI_IER_RXRDY;
+	}
+	else if (status & TWI_SR_RXRDY)
+	{
+		twi->TWI_IDR = TWI_IDR_RXRDY | TWI_IDR_NACK;
+		_twiBuffer[_twiCount-1] = twi->TWI_RHR;
+		while (((twi->TWI_SR & TWI_SR_TXCOMP) != TWI_SR_TXCOMP) && (!_busExpired())) {};	// Only the STOP condition is left
+		_burstDone(_status == BUS_OK);
+	}
+}
+
+void TWI1_Handler(void)
+{
+	if (_twiOwner)
+		_twiOwner->_twiISR();
 }
 
+void TWI0_Handler(void)
+{
+	if (_twiOwner)
+		_twiOwner->_twiISR();
+}
+#else
+// No background transfer engine, requests are read synchronously
+bool DS3231::_startBurstRead(uint8_t, uint8_t *, uint8_t)
+{
+	return false;
+}
+#endif
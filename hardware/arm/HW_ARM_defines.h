@@ -11,3 +11,19 @@
 #define TWI_DIV			TWI_DIV_400k	// Set divider for TWI Speed (must match TWI_SPEED setting)
 #define TWI_DIV_100k	1
 #define TWI_DIV_400k	0
+
+// Uncomment one of these to fix the bus at compile time instead of letting
+// begin() choose it from the pins given to the constructor. The test of the
+// bus in every transfer is then gone and the code of the other bus is not
+// linked in. With DS3231_BUS_SOFT the software I2C uses the constant pins
+// DS3231_SDA_PIN and DS3231_SCL_PIN and the constructor pins are ignored.
+//#define DS3231_BUS_HW
+//#define DS3231_BUS_SOFT
+//#define DS3231_SDA_PIN	2
+//#define DS3231_SCL_PIN	3
+
+// Uncomment to move requestTime()/requestRegisters() blocks with the TWI
+// Peripheral DMA Controller instead of reading synchronously. This defines
+// TWI0_Handler/TWI1_Handler and can therefore not be combined with the Wire
+// library in the same sketch.
+//#define DS3231_ASYNC
@@ -1,8 +1,16 @@
+#include <util/twi.h>
+
+#if defined(DS3231_ASYNC)
+	static DS3231	*_twiOwner;
+#endif
+
 void DS3231::begin()
 {
-	if ((_sda_pin == SDA) and (_scl_pin == SCL))
+#if !defined(DS3231_BUS_HW) && !defined(DS3231_BUS_SOFT)
+	_use_hw = (_sda_pin == SDA) and (_scl_pin == SCL);
+#endif
+	if (DS3231_USE_HW)
 	{
-		_use_hw = true;
 		// activate internal pullups for twi.
 		digitalWrite(SDA, HIGH);
 		digitalWrite(SCL, HIGH);
@@ -18,136 +26,328 @@ void DS3231::begin()
 	}
 	else
 	{
-		_use_hw = false;
-		pinMode(_scl_pin, OUTPUT);
+		// Resolve the pins to their port registers once. SDA is open-drain:
+		// driven low through DDR or released to the external pull-up.
+		_sdaMode = portModeRegister(digitalPinToPort(DS3231_SDA));
+		_sdaIn = portInputRegister(digitalPinToPort(DS3231_SDA));
+		_sdaMask = digitalPinToBitMask(DS3231_SDA);
+		_sclOut = portOutputRegister(digitalPinToPort(DS3231_SCL));
+		_sclMask = digitalPinToBitMask(DS3231_SCL);
+		*portOutputRegister(digitalPinToPort(DS3231_SDA)) &= ~_sdaMask;
+		*_sdaMode &= ~_sdaMask;
+		pinMode(DS3231_SCL, OUTPUT);
+		digitalWrite(DS3231_SCL, HIGH);
+		setSoftwareI2CFreq(SOFTI2C_FREQ);
 	}
 }
 
-void DS3231::_burstRead()
+// Bit rate of the software I2C fallback, up to 400 kHz (fast mode). Call it
+// after begin(). Other pins on the SDA and SCL ports must not be changed
+// from interrupts while the RTC is accessed.
+void DS3231::setSoftwareI2CFreq(unsigned long freq)
+{
+	long cycles = (F_CPU / freq / 2) - SOFTI2C_OVERHEAD;
+
+	if (cycles < 0)
+		cycles = 0;
+	cycles /= SOFTI2C_LOOP;
+	_bitDelay = (cycles > 255) ? 255 : cycles;
+}
+
+// Starts a TWI action and waits for it within the transaction budget.
+// Returns the TWI status, or TW_NO_INFO if the budget ran out.
+uint8_t DS3231::_twiCommand(uint8_t twcr)
 {
-	if (_use_hw)
+	TWCR = twcr;
+	while ((TWCR & _BV(TWINT)) == 0)												// Wait for TWI to be ready
+	{
+		if (_busExpired())
+			return TW_NO_INFO;
+	}
+	return TW_STATUS;
+}
+
+// Sends START, the write address and the register address, and for reads the
+// repeated START and the read address. Releases the bus on failure.
+bool DS3231::_twiSelect(uint8_t reg, bool read)
+{
+	uint8_t	twst;
+
+	twst = _twiCommand(_BV(TWEN) | _BV(TWINT) | _BV(TWSTA));						// Send START
+	if (twst == TW_START)
 	{
-		// Send start address
-		TWCR = _BV(TWEN) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);						// Send START
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
 		TWDR = DS3231_ADDR_W;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = 0;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-
-		// Read data starting from start address
-		TWCR = _BV(TWEN) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);						// Send rep. START
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = DS3231_ADDR_R;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		for (int i=0; i<7; i++)
+		twst = _twiCommand(_BV(TWEN) | _BV(TWINT));									// Send write address
+	}
+	if (twst == TW_MT_SLA_ACK)
+	{
+		TWDR = reg;
+		twst = _twiCommand(_BV(TWEN) | _BV(TWINT));									// Send register address
+	}
+	if (read && (twst == TW_MT_DATA_ACK))
+	{
+		twst = _twiCommand(_BV(TWEN) | _BV(TWINT) | _BV(TWSTA));					// Send rep. START
+		if (twst == TW_REP_START)
 		{
-			TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);								// Send ACK and clear TWINT to proceed
-			while ((TWCR & _BV(TWINT)) == 0) {};									// Wait for TWI to be ready
-			_burstArray[i] = TWDR;
+			TWDR = DS3231_ADDR_R;
+			twst = _twiCommand(_BV(TWEN) | _BV(TWINT));								// Send read address
 		}
-		TWCR = _BV(TWEN) | _BV(TWINT);												// Send NACK and clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
+	}
+	if (twst == (read ? TW_MR_SLA_ACK : TW_MT_DATA_ACK))
+		return true;
+	_twiFail(twst);
+	return false;
+}
 
-		TWCR = _BV(TWEN)| _BV(TWINT) | _BV(TWSTO);									// Send STOP
+void DS3231::_twiFail(uint8_t twst)
+{
+	if (_status == BUS_OK)
+	{
+		if ((twst == TW_MT_SLA_NACK) || (twst == TW_MT_DATA_NACK) || (twst == TW_MR_SLA_NACK))
+			_status = BUS_NACK;
+		else
+			_status = BUS_ERROR;
 	}
+	_busReset();
+}
+
+// Releases the bus after a failed transfer. After a NACK a STOP is enough,
+// otherwise the TWI is switched off and on again, which frees SDA and SCL
+// in any state.
+void DS3231::_busReset()
+{
+	if (_status == BUS_NACK)
+		TWCR = _BV(TWEN)| _BV(TWINT) | _BV(TWSTO);									// Send STOP
 	else
 	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(0);
-		_waitForAck();
-		_sendStart(DS3231_ADDR_R);
-		_waitForAck();
-
-		for (int i=0; i<7; i++)
+		TWCR = 0;
+		TWCR = _BV(TWEN);
+	}
+}
+
+void DS3231::_burstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	if (DS3231_USE_HW)
+	{
+		uint8_t	twst;
+
+		_busBegin();
+		if ((!_waitForAsync()) || (!_twiSelect(reg, true)))
+			return;
+		for (int i=0; i<count; i++)
 		{
-			_burstArray[i] = _readByte();
-			if (i<6)
-				_sendAck();
+			if (i<count-1)
+				twst = _twiCommand(_BV(TWEN) | _BV(TWINT) | _BV(TWEA));				// Send ACK and clear TWINT to proceed
 			else
-				_sendNack();
+				twst = _twiCommand(_BV(TWEN) | _BV(TWINT));							// Send NACK after the last byte
+			if ((twst != TW_MR_DATA_ACK) && (twst != TW_MR_DATA_NACK))
+			{
+				_twiFail(twst);
+				return;
+			}
+			buffer[i] = TWDR;
 		}
-		_sendStop();
+
+		TWCR = _BV(TWEN)| _BV(TWINT) | _BV(TWSTO);									// Send STOP
 	}
+	else
+		_softBurstRead(reg, buffer, count);
 }
 
-uint8_t DS3231::_readRegister(uint8_t reg)
+void DS3231::_burstWrite(uint8_t reg, uint8_t *values, uint8_t count)
 {
-	uint8_t	readValue=0;
-
-	if (_use_hw)
+	if (DS3231_USE_HW)
 	{
-		// Send start address
-		TWCR = _BV(TWEN) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);						// Send START
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = DS3231_ADDR_W;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = reg;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-
-		// Read data starting from start address
-		TWCR = _BV(TWEN) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);						// Send rep. START
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = DS3231_ADDR_R;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Send ACK and clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		readValue = TWDR;
-		TWCR = _BV(TWEN) | _BV(TWINT);												// Send NACK and clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
+		uint8_t	twst;
+
+		_busBegin();
+		if ((!_waitForAsync()) || (!_twiSelect(reg, false)))
+			return;
+
+		// Write data, the register pointer auto-increments
+		for (int i=0; i<count; i++)
+		{
+			TWDR = values[i];
+			twst = _twiCommand(_BV(TWEN) | _BV(TWINT));								// Clear TWINT to proceed
+			if (twst != TW_MT_DATA_ACK)
+			{
+				_twiFail(twst);
+				return;
+			}
+		}
 
 		TWCR = _BV(TWEN)| _BV(TWINT) | _BV(TWSTO);									// Send STOP
 	}
 	else
+		_softBurstWrite(reg, values, count);
+}
+
+#if defined(DS3231_ASYNC)
+bool DS3231::_startBurstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	if (!DS3231_USE_HW)
+		return false;
+	_twiOwner = this;
+	_twiReg = reg;
+	_twiBuffer = buffer;
+	_twiCount = count;
+	_twiIndex = 0;
+	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTA);						// Send START, continue in the ISR
+	return true;
+}
+
+// TWI state machine for the background burst read of a register block
+void DS3231::_twiISR()
+{
+	switch (TW_STATUS)
 	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(reg);
-		_waitForAck();
-		_sendStart(DS3231_ADDR_R);
-		_waitForAck();
-		readValue = _readByte();
-		_sendNack();
-		_sendStop();
+		case TW_START:																// START sent
+			TWDR = DS3231_ADDR_W;
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+			break;
+		case TW_MT_SLA_ACK:															// Write address ACKed
+			TWDR = _twiReg;
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+			break;
+		case TW_MT_DATA_ACK:														// Register address ACKed
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTA);					// Send rep. START
+			break;
+		case TW_REP_START:															// Rep. START sent
+			TWDR = DS3231_ADDR_R;
+			TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);
+			break;
+		case TW_MR_SLA_ACK:															// Read address ACKed
+			if (_twiCount > 1)
+				TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);				// ACK the first byte
+			else
+				TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);							// NACK the only byte
+			break;
+		case TW_MR_DATA_ACK:														// Byte received, ACK sent
+			_twiBuffer[_twiIndex++] = TWDR;
+			if (_twiIndex < _twiCount-1)
+				TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);				// ACK the next byte
+			else
+				TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT);							// NACK the last byte
+			break;
+		case TW_MR_DATA_NACK:														// Last byte received
+			_twiBuffer[_twiIndex] = TWDR;
+			TWCR = _BV(TWEN)| _BV(TWINT) | _BV(TWSTO);								// Send STOP
+			_burstDone(true);
+			break;
+		default:																	// NACK, arbitration lost or bus error
+			_twiFail(TW_STATUS);													// Send STOP or reset the TWI
+			_burstDone(false);
+			break;
 	}
-	return readValue;
 }
 
-void DS3231::_writeRegister(uint8_t reg, uint8_t value)
+ISR(TWI_vect)
 {
-	if (_use_hw)
-	{
-		// Send start address
-		TWCR = _BV(TWEN) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);						// Send START
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = DS3231_ADDR_W;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = reg;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
-		TWDR = value;
-		TWCR = _BV(TWEN) | _BV(TWINT) | _BV(TWEA);									// Clear TWINT to proceed
-		while ((TWCR & _BV(TWINT)) == 0) {};										// Wait for TWI to be ready
+	if (_twiOwner)
+		_twiOwner->_twiISR();
+}
+#else
+// No background transfer engine, requests are read synchronously
+bool DS3231::_startBurstRead(uint8_t, uint8_t *, uint8_t)
+{
+	return false;
+}
+#endif
 
-		TWCR = _BV(TWEN)| _BV(TWINT) | _BV(TWSTO);									// Send STOP
-	}
-	else
+// *** Software I2C with direct port access ***
+#define _sdaLow()	(*_sdaMode |= _sdaMask)
+#define _sdaHigh()	(*_sdaMode &= ~_sdaMask)
+#define _sdaRead()	(*_sdaIn & _sdaMask)
+#define _sclLow()	(*_sclOut &= ~_sclMask)
+#define _sclHigh()	(*_sclOut |= _sclMask)
+#define _halfBit()	for (uint8_t _d=_bitDelay; _d; _d--) { __asm__ __volatile__ ("nop"); }
+
+void	DS3231::_sendStart(byte addr)
+{
+	_sdaHigh();
+	_sclHigh();
+	_halfBit();
+	_sdaLow();
+	_halfBit();
+	_sclLow();
+	_writeByte(addr);
+}
+
+void	DS3231::_sendStop()
+{
+	_sdaLow();
+	_halfBit();
+	_sclHigh();
+	_halfBit();
+	_sdaHigh();
+	_halfBit();
+}
+
+void	DS3231::_sendNack()
+{
+	_sclLow();
+	_sdaHigh();
+	_halfBit();
+	_sclHigh();
+	_halfBit();
+	_sclLow();
+}
+
+void	DS3231::_sendAck()
+{
+	_sclLow();
+	_sdaLow();
+	_halfBit();
+	_sclHigh();
+	_halfBit();
+	_sclLow();
+	_sdaHigh();
+}
+
+// Samples the ACK bit, SDA released by the RTC is a NACK
+bool	DS3231::_waitForAck()
+{
+	bool ack;
+
+	_sdaHigh();
+	_halfBit();
+	_sclHigh();
+	_halfBit();
+	ack = !_sdaRead();
+	_sclLow();
+	return ack;
+}
+
+uint8_t DS3231::_readByte()
+{
+	uint8_t value = 0;
+
+	_sdaHigh();
+	for (uint8_t i = 0; i < 8; ++i)
 	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(reg);
-		_waitForAck();
-		_writeByte(value);
-		_waitForAck();
-		_sendStop();
+		_halfBit();
+		_sclHigh();
+		_halfBit();
+		value <<= 1;
+		if (_sdaRead())
+			value |= 1;
+		_sclLow();
 	}
+	return value;
 }
 
+void DS3231::_writeByte(uint8_t value)
+{
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		if (value & 0x80)
+			_sdaHigh();
+		else
+			_sdaLow();
+		value <<= 1;
+		_halfBit();
+		_sclHigh();
+		_halfBit();
+		_sclLow();
+	}
+}
@@ -1,6 +1,34 @@
 // *** Hardwarespecific defines ***
 #define cbi(sfr, bit) (_SFR_BYTE(sfr) &= ~_BV(bit))
 
+// Constant tables, e.g. the day and month names, stay in flash and are read
+// with pgm_read_byte() instead of being copied to RAM at startup
+#define DS3231_PROGMEM			PROGMEM
+#define DS3231_READ_BYTE(p)		pgm_read_byte(p)
+
 #ifndef TWI_FREQ
 	#define TWI_FREQ 400000L
 #endif
+
+// The software I2C fallback toggles the port registers directly
+#define SOFTI2C_PORTS
+#ifndef SOFTI2C_FREQ
+	#define SOFTI2C_FREQ 100000L	// Default bit rate, see setSoftwareI2CFreq()
+#endif
+#define SOFTI2C_OVERHEAD	8		// CPU cycles per half bit spent outside the delay loop
+#define SOFTI2C_LOOP		4		// CPU cycles per delay loop iteration
+
+// Uncomment one of these to fix the bus at compile time instead of letting
+// begin() choose it from the pins given to the constructor. The test of the
+// bus in every transfer is then gone and the code of the other bus is not
+// linked in. With DS3231_BUS_SOFT the software I2C uses the constant pins
+// DS3231_SDA_PIN and DS3231_SCL_PIN and the constructor pins are ignored.
+//#define DS3231_BUS_HW
+//#define DS3231_BUS_SOFT
+//#define DS3231_SDA_PIN	A4
+//#define DS3231_SCL_PIN	A5
+
+// Uncomment to run requestTime() transfers from the TWI interrupt instead of
+// reading synchronously. This defines ISR(TWI_vect) and can therefore not be
+// combined with the Wire library in the same sketch.
+//#define DS3231_ASYNC
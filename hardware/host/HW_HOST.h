@@ -0,0 +1,397 @@
+DS3231_Sim DS3231_sim;
+
+static const uint8_t _simDays[] = { 31,28,31,30,31,30,31,31,30,31,30,31 };
+
+static inline uint8_t _simBCD(uint8_t value) { return (value & 15) + 10 * (value >> 4); }
+static inline uint8_t _simEnc(uint8_t value) { return ((value / 10) << 4) + (value % 10); }
+
+// Decode a DS3231 hour register (12 or 24 hour mode) to 0-23
+static uint8_t _simHour(uint8_t value)
+{
+	if (value & 0x40)
+		return (_simBCD(value & 0x1F) % 12) + ((value & 0x20) ? 12 : 0);
+	return _simBCD(value & 0x3F);
+}
+
+DS3231_Sim::DS3231_Sim()
+{
+	_elapsedNs = 0;
+	sqw = NULL;
+	mcuPpm = 0;
+	rtcPpb = 0;
+	powerOn();
+}
+
+// Power-on reset state from the datasheet: 00:00:00 01.01.00, INTCN and
+// RS2/RS1 set, OSF and EN32kHz set.
+void DS3231_Sim::powerOn()
+{
+	for (int i=0; i<DS3231_SIM_REGS; i++)
+		regs[i] = 0;
+	regs[0x03] = 1;
+	regs[0x04] = 1;
+	regs[0x05] = 1;
+	regs[0x0E] = 0x1C;
+	regs[0x0F] = 0x88;
+	temperature = 25 * 4;
+	present = true;
+	_ptr = 0;
+	_selected = false;
+	_readMode = false;
+	_ptrPending = false;
+	_nsec = 0;
+	_nsecRem = 0;
+	_agingPpb = 0;
+	_convNs = 0;
+	_tempSec = 0;
+	_latch();
+	resetCounters();
+}
+
+void DS3231_Sim::resetCounters()
+{
+	starts = 0;
+	stops = 0;
+	bytes = 0;
+	sclCycles = 0;
+}
+
+// Simulated time since the start of the program
+uint32_t DS3231_Sim::elapsedUs()
+{
+	return (uint32_t)(_elapsedNs / 1000);
+}
+
+uint64_t DS3231_Sim::elapsedMs()
+{
+	return _elapsedNs / 1000000;
+}
+
+uint32_t DS3231_Sim::mcuMicros()
+{
+	int64_t usec = _elapsedNs / 1000;
+
+	return (uint32_t)(usec + usec * mcuPpm / 1000000);
+}
+
+// millis() of the simulated MCU, whose clock runs mcuPpm off like micros()
+uint32_t DS3231_Sim::mcuMillis()
+{
+	int64_t usec = _elapsedNs / 1000;
+
+	return (uint32_t)((usec + usec * mcuPpm / 1000000) / 1000);
+}
+
+// Time since the last seconds update of the clock registers
+uint32_t DS3231_Sim::fractionUs()
+{
+	return _nsec / 1000;
+}
+
+void DS3231_Sim::advance(uint32_t usec)
+{
+	_clock((uint64_t)usec * 1000);
+}
+
+uint32_t DS3231_Sim::busTimeUs()
+{
+	return (uint32_t)(((uint64_t)sclCycles * 1000000) / TWI_FREQ);
+}
+
+bool DS3231_Sim::start(uint8_t addr)
+{
+	starts++;
+	_byte();
+	_latch();
+	_selected = present && ((addr >> 1) == DS3231_ADDR);
+	_readMode = (addr & 1);
+	_ptrPending = !_readMode;
+	return _selected;
+}
+
+bool DS3231_Sim::write(uint8_t value)
+{
+	_byte();
+	if (!_selected || _readMode)
+		return false;
+	if (_ptrPending)
+	{
+		_ptr = value % DS3231_SIM_REGS;
+		_ptrPending = false;
+	}
+	else
+	{
+		_setRegister(_ptr, value);
+		if (++_ptr == DS3231_SIM_REGS)
+			_ptr = 0;
+	}
+	return true;
+}
+
+uint8_t DS3231_Sim::read(bool ack)
+{
+	uint8_t value;
+
+	_byte();
+	if (!_selected || !_readMode)
+		return 0xFF;
+	value = (_ptr < 7) ? _buffer[_ptr] : regs[_ptr];
+	if (++_ptr == DS3231_SIM_REGS)
+	{
+		_ptr = 0;
+		_latch();
+	}
+	if (!ack)
+		_selected = false;
+	return value;
+}
+
+void DS3231_Sim::stop()
+{
+	stops++;
+	_selected = false;
+}
+
+// One byte on the bus: 8 data bits and the ACK bit
+void DS3231_Sim::_byte()
+{
+	bytes++;
+	sclCycles += 9;
+	_clock((uint64_t)9 * 1000000000 / TWI_FREQ);
+}
+
+void DS3231_Sim::_latch()
+{
+	for (int i=0; i<7; i++)
+		_buffer[i] = regs[i];
+}
+
+void DS3231_Sim::_setRegister(uint8_t reg, uint8_t value)
+{
+	switch (reg)
+	{
+		case 0x00:
+			_nsec = 0;								// Writing seconds resets the countdown chain
+			_nsecRem = 0;
+			regs[reg] = value & 0x7F;
+			break;
+		case 0x0E:
+			if (value & 0x20)						// CONV
+			{
+				regs[reg] = value;
+				if (!(regs[0x0F] & 0x04))
+					_startConversion();
+			}
+			else
+				regs[reg] = value | (regs[reg] & 0x20);	// CONV can not be cleared by the user
+			break;
+		case 0x0F:
+			// A2F and A1F can only be cleared, writing 1 keeps them. OSF takes the
+			// value written. BSY is read-only.
+			regs[reg] = (regs[reg] & 0x04) | (value & 0xF8) | (regs[reg] & value & 0x03);
+			break;
+		case 0x11:
+		case 0x12:
+			break;									// Temperature registers are read-only
+		default:
+			regs[reg] = value;
+			break;
+	}
+	if (reg < 7)
+		_buffer[reg] = regs[reg];
+}
+
+void DS3231_Sim::_clock(uint64_t nsec)
+{
+	int64_t		rate;
+	uint64_t	step;
+
+	// Step second by second, so that the SQW callback sees the time of its edge
+	// and a conversion started by a tick runs on in the same call. The
+	// oscillator runs rtcPpb fast, less the aging offset, so one second of the
+	// chip takes step ns of simulated time.
+	for (;;)
+	{
+		rate = 1000000000LL + rtcPpb + _agingPpb;
+		step = ((uint64_t)(1000000000 - _nsec) * 1000000000 - _nsecRem + rate - 1) / rate;
+		if (nsec < step)
+			break;
+		_convert(step);
+		_elapsedNs += step;
+		nsec -= step;
+		_nsec = 0;
+		_nsecRem = 0;
+		_tick();
+	}
+	_convert(nsec);
+	_elapsedNs += nsec;
+	_nsecRem += nsec * rate;
+	_nsec += _nsecRem / 1000000000;
+	_nsecRem %= 1000000000;
+}
+
+void DS3231_Sim::_convert(uint64_t nsec)
+{
+	if (_convNs)
+	{
+		if (nsec >= _convNs)
+			_endConversion();
+		else
+			_convNs -= nsec;
+	}
+}
+
+// Advance the clock and calendar registers by one second
+void DS3231_Sim::_tick()
+{
+	uint8_t sec  = _simBCD(regs[0x00] & 0x7F);
+	uint8_t min  = _simBCD(regs[0x01] & 0x7F);
+	uint8_t hour = _simHour(regs[0x02]);
+	uint8_t dow  = regs[0x03] & 0x07;
+	uint8_t date = _simBCD(regs[0x04] & 0x3F);
+	uint8_t mon  = _simBCD(regs[0x05] & 0x1F);
+	uint8_t year = _simBCD(regs[0x06]);
+	uint8_t century = regs[0x05] & 0x80;
+	uint8_t mdays;
+
+	if (++sec > 59)
+	{
+		sec = 0;
+		if (++min > 59)
+		{
+			min = 0;
+			if (++hour > 23)
+			{
+				hour = 0;
+				dow = (dow % 7) + 1;
+				mdays = _simDays[(mon - 1) % 12] + (((mon == 2) && !(year % 4)) ? 1 : 0);
+				if (++date > mdays)
+				{
+					date = 1;
+					if (++mon > 12)
+					{
+						mon = 1;
+						if (++year > 99)
+						{
+							year = 0;
+							century ^= 0x80;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	regs[0x00] = _simEnc(sec);
+	regs[0x01] = _simEnc(min);
+	if (regs[0x02] & 0x40)
+		regs[0x02] = 0x40 | ((hour >= 12) ? 0x20 : 0) | _simEnc((hour % 12) ? (hour % 12) : 12);
+	else
+		regs[0x02] = _simEnc(hour);
+	regs[0x03] = dow;
+	regs[0x04] = _simEnc(date);
+	regs[0x05] = century | _simEnc(mon);
+	regs[0x06] = _simEnc(year);
+
+	_checkAlarms();
+
+	// INTCN clear and RS2/RS1 = 00 select the 1 Hz square wave, whose falling
+	// edge comes with the seconds update
+	if (sqw && !(regs[0x0E] & 0x1C))
+		sqw();
+
+	if (++_tempSec >= 64)
+	{
+		_tempSec = 0;
+		if (!(regs[0x0F] & 0x04))
+			_startConversion();
+	}
+}
+
+// Set A1F/A2F when the alarm registers match the new time
+void DS3231_Sim::_checkAlarms()
+{
+	uint8_t sec  = _simBCD(regs[0x00]);
+	uint8_t min  = _simBCD(regs[0x01]);
+	uint8_t hour = _simHour(regs[0x02]);
+	bool match;
+
+	match = ((regs[0x07] & 0x80) || (_simBCD(regs[0x07] & 0x7F) == sec)) &&
+		((regs[0x08] & 0x80) || (_simBCD(regs[0x08] & 0x7F) == min)) &&
+		((regs[0x09] & 0x80) || (_simHour(regs[0x09] & 0x7F) == hour)) &&
+		((regs[0x0A] & 0x80) || ((regs[0x0A] & 0x40) ?
+			((regs[0x0A] & 0x0F) == regs[0x03]) : (_simBCD(regs[0x0A] & 0x3F) == _simBCD(regs[0x04]))));
+	if (match)
+		regs[0x0F] |= 0x01;
+
+	if (sec == 0)
+	{
+		match = ((regs[0x0B] & 0x80) || (_simBCD(regs[0x0B] & 0x7F) == min)) &&
+			((regs[0x0C] & 0x80) || (_simHour(regs[0x0C] & 0x7F) == hour)) &&
+			((regs[0x0D] & 0x80) || ((regs[0x0D] & 0x40) ?
+				((regs[0x0D] & 0x0F) == regs[0x03]) : (_simBCD(regs[0x0D] & 0x3F) == _simBCD(regs[0x04]))));
+		if (match)
+			regs[0x0F] |= 0x02;
+	}
+}
+
+void DS3231_Sim::_startConversion()
+{
+	regs[0x0F] |= 0x04;										// BSY
+	_convNs = DS3231_SIM_CONV_US * 1000;
+}
+
+void DS3231_Sim::_endConversion()
+{
+	_convNs = 0;
+	regs[0x11] = (uint8_t)(temperature >> 2);
+	regs[0x12] = (uint8_t)((temperature & 3) << 6);
+	_agingPpb = -100 * (int8_t)regs[0x10];					// 0.1 ppm per LSB, applied by the conversion
+	regs[0x0E] &= ~0x20;									// CONV
+	regs[0x0F] &= ~0x04;									// BSY
+}
+
+void DS3231::begin()
+{
+	// The simulated chip is always attached to the (simulated) hardware bus
+#if !defined(DS3231_BUS_HW) && !defined(DS3231_BUS_SOFT)
+	_use_hw = true;
+#endif
+}
+
+void DS3231::_burstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	_busBegin();
+	if (DS3231_sim.start(DS3231_ADDR_W) && DS3231_sim.write(reg) && DS3231_sim.start(DS3231_ADDR_R))
+	{
+		for (int i=0; i<count; i++)
+			buffer[i] = DS3231_sim.read(i<count-1);
+	}
+	else
+		_status = BUS_NACK;
+	DS3231_sim.stop();
+}
+
+void DS3231::_burstWrite(uint8_t reg, uint8_t *values, uint8_t count)
+{
+	_busBegin();
+	if (DS3231_sim.start(DS3231_ADDR_W) && DS3231_sim.write(reg))
+	{
+		for (int i=0; i<count; i++)
+			DS3231_sim.write(values[i]);
+	}
+	else
+		_status = BUS_NACK;
+	DS3231_sim.stop();
+}
+
+// The simulated bus can not hang
+void DS3231::_busReset()
+{
+}
+
+// No background transfer engine, requests are read synchronously
+bool DS3231::_startBurstRead(uint8_t, uint8_t *, uint8_t)
+{
+	return false;
+}
@@ -0,0 +1,115 @@
+// *** Hardwarespecific defines ***
+//
+// Host (Linux/desktop) build of the library. Compile with -DDS3231_HOST and
+// the DS3231 is replaced by an in-memory model of the chip (DS3231_sim) that
+// sits on a simulated I2C bus and counts every bus event, so the bus cost of
+// the library can be measured without any hardware attached.
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+typedef uint8_t	byte;
+typedef bool	boolean;
+
+#define HIGH		1
+#define LOW			0
+#define INPUT		0
+#define OUTPUT		1
+#define MSBFIRST	1
+
+#define SDA		20
+#define SCL		21
+
+#ifndef _BV
+	#define _BV(bit) (1 << (bit))
+#endif
+
+#ifndef TWI_FREQ
+	#define TWI_FREQ 400000L
+#endif
+
+#define BATCH_BLOCK	64			// Block size of the batch conversions, sized for SIMD
+
+// There are no pins on the host; the software I2C fallback compiles against
+// these stubs but is never selected by begin().
+inline void		pinMode(uint8_t, uint8_t) {}
+inline void		digitalWrite(uint8_t, uint8_t) {}
+inline int		digitalRead(uint8_t) { return LOW; }
+inline void		shiftOut(uint8_t, uint8_t, uint8_t, uint8_t) {}
+inline void		delayMicroseconds(unsigned int) {}
+
+#define DS3231_SIM_REGS		0x13	// Register file 0x00-0x12
+#define DS3231_SIM_CONV_US	125000L	// Temperature conversion time (tCONV typ.)
+
+// Simulated DS3231 register file and I2C slave.
+// The oscillator advances with simulated bus time (9 SCL cycles per byte at
+// TWI_FREQ) and with explicit calls to advance(). Alarm flags, the automatic
+// 64 second temperature conversion, forced conversions (CONV/BSY), the
+// clear-only alarm flags and the 1 Hz square wave behave like the real chip. Reads of 0x00-0x06 come
+// from a user buffer latched on START and on register pointer wrap-around,
+// exactly like the DS3231 does.
+class DS3231_Sim
+{
+public:
+	uint8_t		regs[DS3231_SIM_REGS];
+	int16_t		temperature;	// Die temperature in 1/4 C used for the next conversion
+	bool		present;		// False simulates a missing RTC, nothing is acknowledged
+	void		(*sqw)();		// Called on the falling edge of the 1 Hz square wave
+	int32_t		mcuPpm;			// Error of the simulated MCU clock (micros()) in ppm
+	int32_t		rtcPpb;			// Error of the RTC oscillator in ppb, before the aging offset
+
+	// Bus statistics
+	uint32_t	starts;			// START and repeated START conditions
+	uint32_t	stops;			// STOP conditions
+	uint32_t	bytes;			// Bytes on the bus, address bytes included
+	uint32_t	sclCycles;		// SCL clock cycles (8 data + 1 ACK per byte)
+
+	DS3231_Sim();
+	void		powerOn();
+	void		resetCounters();
+	void		advance(uint32_t usec);
+	uint32_t	busTimeUs();
+	uint32_t	elapsedUs();
+	uint64_t	elapsedMs();
+	uint32_t	mcuMicros();
+	uint32_t	mcuMillis();
+	uint32_t	fractionUs();
+
+	// Bus primitives used by the host backend
+	bool		start(uint8_t addr);
+	bool		write(uint8_t value);
+	uint8_t		read(bool ack);
+	void		stop();
+
+private:
+	uint8_t		_buffer[7];
+	uint8_t		_ptr;
+	bool		_selected;
+	bool		_readMode;
+	bool		_ptrPending;
+	uint32_t	_nsec;
+	uint64_t	_nsecRem;		// Fraction of a chip ns, in 1e-9 ns
+	int32_t		_agingPpb;		// Effect of the aging offset latched by the last conversion
+	uint32_t	_convNs;
+	uint8_t		_tempSec;
+	uint64_t	_elapsedNs;
+
+	void		_clock(uint64_t nsec);
+	void		_byte();
+	void		_latch();
+	void		_setRegister(uint8_t reg, uint8_t value);
+	void		_tick();
+	void		_checkAlarms();
+	void		_startConversion();
+	void		_convert(uint64_t nsec);
+	void		_endConversion();
+};
+
+extern DS3231_Sim DS3231_sim;
+
+// The MCU clock of the host build is the simulated time, which advances with
+// bus traffic and DS3231_sim.advance(), off by DS3231_sim.mcuPpm
+inline unsigned long	micros() { return DS3231_sim.mcuMicros(); }
+inline unsigned long	millis() { return DS3231_sim.mcuMillis(); }
+inline void				noInterrupts() {}
+inline void				interrupts() {}
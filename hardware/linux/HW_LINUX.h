@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+// Opens /dev/i2c-N, N being the first argument of the constructor. A failed
+// open() shows up as BUS_ERROR on the first transfer. The kernel applies the
+// bus timeout set with setBusTimeout() before begin(), in steps of 10 ms.
+void DS3231::begin()
+{
+	char	path[24];
+
+#if !defined(DS3231_BUS_HW) && !defined(DS3231_BUS_SOFT)
+	_use_hw = true;
+#endif
+	if (_fd >= 0)
+		close(_fd);
+	snprintf(path, sizeof(path), DS3231_I2C_DEV, _sda_pin);
+	_fd = open(path, O_RDWR);
+	if ((_fd >= 0) && (_timeout > 0))
+		ioctl(_fd, I2C_TIMEOUT, (_timeout + 9999) / 10000);
+}
+
+// Closes /dev/i2c-N
+DS3231::~DS3231()
+{
+	if (_fd >= 0)
+		close(_fd);
+	pthread_mutex_destroy(&_softMutex);
+}
+
+// Runs the messages as one combined transaction in a single system call
+bool DS3231::_i2cTransfer(struct i2c_msg *msgs, uint8_t count)
+{
+	struct i2c_rdwr_ioctl_data	data;
+
+	_busBegin();
+	if (_fd < 0)
+	{
+		_status = BUS_ERROR;
+		return false;
+	}
+	data.msgs = msgs;
+	data.nmsgs = count;
+	if (ioctl(_fd, I2C_RDWR, &data) < 0)
+	{
+		if ((errno == ENXIO) || (errno == EREMOTEIO))
+			_status = BUS_NACK;
+		else if (errno == ETIMEDOUT)
+			_status = BUS_TIMEOUT;
+		else
+			_status = BUS_ERROR;
+		return false;
+	}
+	return true;
+}
+
+void DS3231::_burstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
+{
+	struct i2c_msg	msgs[2];
+
+	msgs[0].addr = DS3231_ADDR;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &reg;
+	msgs[1].addr = DS3231_ADDR;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = count;
+	msgs[1].buf = buffer;
+	_i2cTransfer(msgs, 2);
+}
+
+// Writes longer than one message are refused with BUS_ERROR, not split: a
+// burst is written in one transaction so that the chip sees it at once
+void DS3231::_burstWrite(uint8_t reg, uint8_t *values, uint8_t count)
+{
+	struct i2c_msg	msg;
+	uint8_t			data[LINUX_MAX_WRITE];
+
+	if (count > LINUX_MAX_WRITE - 1)
+	{
+		_busBegin();
+		_status = BUS_ERROR;
+		return;
+	}
+	data[0] = reg;
+	for (int i=0; i<count; i++)
+		data[i + 1] = values[i];
+	msg.addr = DS3231_ADDR;
+	msg.flags = 0;
+	msg.len = count + 1;
+	msg.buf = data;
+	_i2cTransfer(&msg, 1);
+}
+
+// The kernel driver recovers the bus itself
+void DS3231::_busReset()
+{
+}
+
+// No background transfer engine, requests are read synchronously
+bool DS3231::_startBurstRead(uint8_t, uint8_t *, uint8_t)
+{
+	return false;
+}
@@ -0,0 +1,83 @@
+// *** Hardwarespecific defines ***
+//
+// Linux build of the library for single-board computers and gateways.
+// Compile with -DDS3231_LINUX and the RTC is accessed through the i2c-dev
+// driver (/dev/i2c-N). Every transfer is a single I2C_RDWR ioctl; reading
+// registers is one combined write-then-read transaction with a repeated
+// START, so getTime() costs exactly one system call.
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/i2c.h>
+
+#if defined(DS3231_BUS_SOFT)
+	#error "There is no software I2C on Linux, use the i2c-dev bus"
+#endif
+
+typedef uint8_t	byte;
+typedef bool	boolean;
+
+#define HIGH		1
+#define LOW			0
+#define INPUT		0
+#define OUTPUT		1
+#define MSBFIRST	1
+
+// The first argument of the constructor is the number N of /dev/i2c-N.
+// DS3231(SDA, SCL) opens DS3231_I2C_BUS, the second argument is not used.
+#ifndef DS3231_I2C_BUS
+	#define DS3231_I2C_BUS	1		// The header pins of a Raspberry Pi
+#endif
+#define DS3231_I2C_DEV	"/dev/i2c-%u"
+
+#define SDA		DS3231_I2C_BUS
+#define SCL		0
+
+#ifndef _BV
+	#define _BV(bit) (1 << (bit))
+#endif
+
+#define LINUX_MAX_WRITE	32		// Bytes in one write message, register address included
+
+#define BATCH_BLOCK	64			// Block size of the batch conversions, sized for SIMD
+
+// There are no pins; the software I2C fallback compiles against these
+// stubs but is never selected by begin().
+inline void		pinMode(uint8_t, uint8_t) {}
+inline void		digitalWrite(uint8_t, uint8_t) {}
+inline int		digitalRead(uint8_t) { return LOW; }
+inline void		shiftOut(uint8_t, uint8_t, uint8_t, uint8_t) {}
+inline void		delayMicroseconds(unsigned int usec) { usleep(usec); }
+
+inline unsigned long	micros()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+inline unsigned long	millis()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+// There are no interrupts to disable. tick() runs on a thread of its own,
+// e.g. one waiting for the SQW edges on a GPIO line, maybe on another core:
+// the SeqLock orders its memory accesses in the CPU, and a mutex keeps
+// tick() and the other soft clock writers apart.
+inline void				noInterrupts() {}
+inline void				interrupts() {}
+
+#define SEQ_ACQUIRE()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define SEQ_RELEASE()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define SOFT_LOCK()		pthread_mutex_lock(&_softMutex)
+#define SOFT_UNLOCK()	pthread_mutex_unlock(&_softMutex)
+#define TICK_LOCK()		pthread_mutex_lock(&_softMutex)
+#define TICK_UNLOCK()	pthread_mutex_unlock(&_softMutex)
@@ -1,12 +1,12 @@
-inline void _waitForIdleBus() { while (I2C1CON & 0x1f) {} }
-
 void DS3231::begin()
 {
-	if ((_sda_pin == SDA) and (_scl_pin == SCL))
+#if !defined(DS3231_BUS_HW) && !defined(DS3231_BUS_SOFT)
+	_use_hw = (_sda_pin == SDA) and (_scl_pin == SCL);
+#endif
+	if (DS3231_USE_HW)
 	{
 		uint32_t	tpgd;
 
-		_use_hw = true;
 		pinMode(SDA, OUTPUT);
 		digitalWrite(SDA, HIGH);
 		IFS0CLR = 0xE0000000;									// Clear Interrupt Flag
@@ -19,174 +19,154 @@ void DS3231::begin()
 	}
 	else
 	{
-		_use_hw = false;
-		pinMode(_scl_pin, OUTPUT);
+		pinMode(DS3231_SCL, OUTPUT);
 	}
 }
 
-void DS3231::_burstRead()
+// Waits for bits in I2C1CON to clear within the transaction budget. Fails
+// on a bus collision.
+bool DS3231::_i2cWait(uint32_t conBit)
 {
-	if (_use_hw)
+	while (I2C1CON & conBit)
 	{
-		_waitForIdleBus();									// Wait for I2C bus to be Idle before starting
-		I2C1CONSET = (1 << _I2CCON_SEN);					// Send start condition
-		if (I2C1STAT & (1 << _I2CSTAT_BCL)) { return; }		// Check if there is a bus collision
-		while (I2C1CON & (1 << _I2CCON_SEN)) {}				// Wait for start condition to finish
-		I2C1TRN = (DS3231_ADDR<<1);							// Send device Write address
-		while (I2C1STAT & (1 << _I2CSTAT_IWCOL))			// Check if there is a Write collision
+		if (I2C1STAT & (1 << _I2CSTAT_BCL))						// Check if there is a bus collision
 		{
-			I2C1STATCLR = (1 << _I2CSTAT_IWCOL);			// Clear Write collision flag
-			I2C1TRN = (DS3231_ADDR<<1);						// Retry send device Write address
+			I2C1STATCLR = (1 << _I2CSTAT_BCL);
+			_status = BUS_ERROR;
+			_busReset();
+			return false;
 		}
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		I2C1TRN = 0;										// Send the register address
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		_waitForIdleBus();									// Wait for I2C bus to be Idle before starting
-		I2C1CONSET = (1 << _I2CCON_RSEN);					// Send start condition
-		if (I2C1STAT & (1 << _I2CSTAT_BCL)) { return; }		// Check if there is a bus collision
-		while (I2C1CON & (1 << _I2CCON_RSEN)) {}			// Wait for start condition to finish
-		I2C1TRN = (DS3231_ADDR<<1) | 1;						// Send device Read address
-		while (I2C1STAT & (1 << _I2CSTAT_IWCOL))			// Check if there is a Write collision
+		if (_busExpired())
 		{
-			I2C1STATCLR = (1 << _I2CSTAT_IWCOL);			// Clear Write collision flag
-			I2C1TRN = (DS3231_ADDR<<1) | 1;					// Retry send device Read address
+			_busReset();
+			return false;
 		}
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		byte dummy = I2C1RCV;								// Clear _I2CSTAT_RBF (Receive Buffer Full)
-		for (int i=0; i<7; i++)
-		{
-			_waitForIdleBus();								// Wait for I2C bus to be Idle before continuing
-			I2C1CONSET = (1 << _I2CCON_RCEN);				// Set RCEN to start receive
-			while (I2C1CON & (1 << _I2CCON_RCEN)) {}		// Wait for Receive operation to finish
-			while (!(I2C1STAT & (1 << _I2CSTAT_RBF))) {}	// Wait for Receive Buffer Full
-			_burstArray[i] = I2C1RCV;						// Read data
-			if (i == 6)
-				I2C1CONSET = (1 << _I2CCON_ACKDT);			// Prepare to send NACK
-			else
-				I2C1CONCLR = (1 << _I2CCON_ACKDT);			// Prepare to send ACK
-			I2C1CONSET = (1 << _I2CCON_ACKEN);				// Send ACK/NACK
-			while (I2C1CON & (1 << _I2CCON_ACKEN)) {}		// Wait for ACK/NACK send to finish
-		}
-		I2C1CONSET = (1 << _I2CCON_PEN);					// Send stop condition
-		while (I2C1CON & (1 << _I2CCON_PEN)) {}				// Wait for stop condition to finish
 	}
-	else
-	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(0);
-		_waitForAck();
-		_sendStart(DS3231_ADDR_R);
-		_waitForAck();
+	return true;
+}
 
-		for (int i=0; i<7; i++)
+// Sends one byte and checks the ACK
+bool DS3231::_i2cSend(uint8_t value)
+{
+	I2C1TRN = value;
+	while (I2C1STAT & ((1 << _I2CSTAT_IWCOL) | (1 << _I2CSTAT_TRSTAT)))
+	{
+		if (I2C1STAT & (1 << _I2CSTAT_IWCOL))					// Check if there is a Write collision
 		{
-			_burstArray[i] = _readByte();
-			if (i<6)
-				_sendAck();
-			else
-				_sendNack();
+			I2C1STATCLR = (1 << _I2CSTAT_IWCOL);				// Clear Write collision flag
+			I2C1TRN = value;									// Retry
+		}
+		if (_busExpired())
+		{
+			_busReset();
+			return false;
 		}
-		_sendStop();
 	}
+	if (I2C1STAT & (1 << _I2CSTAT_ACKSTAT))						// NACK received
+	{
+		_status = BUS_NACK;
+		_busReset();
+		return false;
+	}
+	return true;
 }
 
-uint8_t DS3231::_readRegister(uint8_t reg)
+// Sends START, the write address and the register address, and for reads the
+// repeated START and the read address
+bool DS3231::_i2cSelect(uint8_t reg, bool read)
 {
-	uint8_t	readValue=0;
+	if (!_i2cWait(0x1F))										// Wait for I2C bus to be Idle before starting
+		return false;
+	I2C1CONSET = (1 << _I2CCON_SEN);							// Send start condition
+	if ((!_i2cWait(1 << _I2CCON_SEN)) || (!_i2cSend(DS3231_ADDR<<1)) || (!_i2cSend(reg)))
+		return false;
+	if (read)
+	{
+		if (!_i2cWait(0x1F))
+			return false;
+		I2C1CONSET = (1 << _I2CCON_RSEN);						// Send repeated start condition
+		if ((!_i2cWait(1 << _I2CCON_RSEN)) || (!_i2cSend((DS3231_ADDR<<1) | 1)))
+			return false;
+		byte dummy = I2C1RCV;									// Clear _I2CSTAT_RBF (Receive Buffer Full)
+	}
+	return true;
+}
 
-	if (_use_hw)
+// Releases the bus after a failed transfer. After a NACK a stop condition is
+// enough, otherwise the I2C interface is switched off and on again.
+void DS3231::_busReset()
+{
+	if (_status == BUS_NACK)
 	{
-		_waitForIdleBus();									// Wait for I2C bus to be Idle before starting
-		I2C1CONSET = (1 << _I2CCON_SEN);					// Send start condition
-		if (I2C1STAT & (1 << _I2CSTAT_BCL)) { return 0xff; }// Check if there is a bus collision
-		while (I2C1CON & (1 << _I2CCON_SEN)) {}				// Wait for start condition to finish
-		I2C1TRN = (DS3231_ADDR<<1);							// Send device Write address
-		while (I2C1STAT & (1 << _I2CSTAT_IWCOL))			// Check if there is a Write collision
-		{
-			I2C1STATCLR = (1 << _I2CSTAT_IWCOL);			// Clear Write collision flag
-			I2C1TRN = (DS3231_ADDR<<1);						// Retry send device Write address
-		}
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		I2C1TRN = reg;										// Send the register address
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		_waitForIdleBus();									// Wait for I2C bus to be Idle before starting
-		I2C1CONSET = (1 << _I2CCON_RSEN);					// Send start condition
-		if (I2C1STAT & (1 << _I2CSTAT_BCL)) { return 0xff; }// Check if there is a bus collision
-		while (I2C1CON & (1 << _I2CCON_RSEN)) {}			// Wait for start condition to finish
-		I2C1TRN = (DS3231_ADDR<<1) | 1;						// Send device Read address
-		while (I2C1STAT & (1 << _I2CSTAT_IWCOL))			// Check if there is a Write collision
-		{
-			I2C1STATCLR = (1 << _I2CSTAT_IWCOL);			// Clear Write collision flag
-			I2C1TRN = (DS3231_ADDR<<1) | 1;					// Retry send device Read address
-		}
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		byte dummy = I2C1RCV;								// Clear _I2CSTAT_RBF (Receive Buffer Full)
-		_waitForIdleBus();									// Wait for I2C bus to be Idle before continuing
-		I2C1CONSET = (1 << _I2CCON_RCEN);					// Set RCEN to start receive
-		while (I2C1CON & (1 << _I2CCON_RCEN)) {}			// Wait for Receive operation to finish
-		while (!(I2C1STAT & (1 << _I2CSTAT_RBF))) {}		// Wait for Receive Buffer Full
-		readValue = I2C1RCV;								// Read data
-		I2C1CONSET = (1 << _I2CCON_ACKDT);					// Prepare to send NACK
-		I2C1CONSET = (1 << _I2CCON_ACKEN);					// Send NACK
-		while (I2C1CON & (1 << _I2CCON_ACKEN)) {}			// Wait for NACK send to finish
-		I2C1CONSET = (1 << _I2CCON_PEN);					// Send stop condition
-		while (I2C1CON & (1 << _I2CCON_PEN)) {}				// Wait for stop condition to finish
+		I2C1CONSET = (1 << _I2CCON_PEN);						// Send stop condition
+		_i2cWait(1 << _I2CCON_PEN);
 	}
 	else
 	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(reg);
-		_waitForAck();
-		_sendStart(DS3231_ADDR_R);
-		_waitForAck();
-		readValue = _readByte();
-		_sendNack();
-		_sendStop();
+		I2C1CONCLR = (1 << _I2CCON_ON);							// Disable I2C interface
+		I2C1CONSET = (1 << _I2CCON_ON);							// Enable I2C interface
 	}
-	return readValue;
 }
 
-void DS3231::_writeRegister(uint8_t reg, uint8_t value)
+void DS3231::_burstRead(uint8_t reg, uint8_t *buffer, uint8_t count)
 {
-	if (_use_hw)
+	if (DS3231_USE_HW)
 	{
-		_waitForIdleBus();									// Wait for I2C bus to be Idle before starting
-		I2C1CONSET = (1 << _I2CCON_SEN);					// Send start condition
-		if (I2C1STAT & (1 << _I2CSTAT_BCL)) { return; }		// Check if there is a bus collision
-		while (I2C1CON & (1 << _I2CCON_SEN)) {}				// Wait for start condition to finish
-		I2C1TRN = (DS3231_ADDR<<1);							// Send device Write address
-		while (I2C1STAT & (1 << _I2CSTAT_IWCOL))			// Check if there is a Write collision
+		_busBegin();
+		if (!_i2cSelect(reg, true))
+			return;
+		for (int i=0; i<count; i++)
 		{
-			I2C1STATCLR = (1 << _I2CSTAT_IWCOL);			// Clear Write collision flag
-			I2C1TRN = (DS3231_ADDR<<1);						// Retry send device Write address
+			if (!_i2cWait(0x1F))								// Wait for I2C bus to be Idle before continuing
+				return;
+			I2C1CONSET = (1 << _I2CCON_RCEN);					// Set RCEN to start receive
+			if (!_i2cWait(1 << _I2CCON_RCEN))					// Wait for Receive operation to finish
+				return;
+			while (!(I2C1STAT & (1 << _I2CSTAT_RBF)))			// Wait for Receive Buffer Full
+			{
+				if (_busExpired())
+				{
+					_busReset();
+					return;
+				}
+			}
+			buffer[i] = I2C1RCV;								// Read data
+			if (i == count-1)
+				I2C1CONSET = (1 << _I2CCON_ACKDT);				// Prepare to send NACK
+			else
+				I2C1CONCLR = (1 << _I2CCON_ACKDT);				// Prepare to send ACK
+			I2C1CONSET = (1 << _I2CCON_ACKEN);					// Send ACK/NACK
+			if (!_i2cWait(1 << _I2CCON_ACKEN))					// Wait for ACK/NACK send to finish
+				return;
 		}
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		I2C1TRN = reg;										// Send the 1st data byte
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		I2C1TRN = value;									// Send the 2nd data byte
-		while (I2C1STAT & (1 << _I2CSTAT_TRSTAT)) {}		// Wait for transmit to finish
-		while (I2C1STAT & (1 << _I2CSTAT_ACKSTAT)) {}		// Wait for ACK
-		I2C1CONSET = (1 << _I2CCON_PEN);					// Send stop condition
-		while (I2C1CON & (1 << _I2CCON_PEN)) {}				// Wait for stop condition to finish
+		I2C1CONSET = (1 << _I2CCON_PEN);						// Send stop condition
+		_i2cWait(1 << _I2CCON_PEN);								// Wait for stop condition to finish
 	}
 	else
+		_softBurstRead(reg, buffer, count);
+}
+
+void DS3231::_burstWrite(uint8_t reg, uint8_t *values, uint8_t count)
+{
+	if (DS3231_USE_HW)
 	{
-		_sendStart(DS3231_ADDR_W);
-		_waitForAck();
-		_writeByte(reg);
-		_waitForAck();
-		_writeByte(value);
-		_waitForAck();
-		_sendStop();
+		_busBegin();
+		if (!_i2cSelect(reg, false))
+			return;
+		for (int i=0; i<count; i++)
+		{
+			if (!_i2cSend(values[i]))							// Send the data bytes, the register pointer auto-increments
+				return;
+		}
+		I2C1CONSET = (1 << _I2CCON_PEN);						// Send stop condition
+		_i2cWait(1 << _I2CCON_PEN);								// Wait for stop condition to finish
 	}
+	else
+		_softBurstWrite(reg, values, count);
+}
+
+// No background transfer engine, requests are read synchronously
+bool DS3231::_startBurstRead(uint8_t, uint8_t *, uint8_t)
+{
+	return false;
 }
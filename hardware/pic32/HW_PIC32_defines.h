@@ -19,3 +19,12 @@
 	#define TWI_FREQ 400000L
 #endif
 
+// Uncomment one of these to fix the bus at compile time instead of letting
+// begin() choose it from the pins given to the constructor. The test of the
+// bus in every transfer is then gone and the code of the other bus is not
+// linked in. With DS3231_BUS_SOFT the software I2C uses the constant pins
+// DS3231_SDA_PIN and DS3231_SCL_PIN and the constructor pins are ignored.
+//#define DS3231_BUS_HW
+//#define DS3231_BUS_SOFT
+//#define DS3231_SDA_PIN	2
+//#define DS3231_SCL_PIN	3